@@ -17,7 +17,8 @@
  * (patshift % patshift) bytes.
  *
  * pattern_check returns -1 if the buffer does not contain repeated
- * occurrances of the indicated pattern (shifted by patshift).
+ * occurrances of the indicated pattern (shifted by patshift), or if
+ * patlen is less than 1.
  *
  * The algorithm used to check the buffer relies on the fact that buf is 
  * supposed to be repeated copies of pattern.  The basic algorithm is
@@ -34,6 +35,15 @@
  */
 int pattern_check( char * , int , char * , int , int );
 
+/*
+ * pattern_check_offset(buf, buflen, pat, patlen, patshift)
+ *
+ * Same as pattern_check, but returns the offset in buf of the first byte
+ * which does not match the pattern, or -1 if the whole buffer matches.
+ * With a patlen less than 1, no byte matches.
+ */
+int pattern_check_offset( char * , int , char * , int , int );
+
 /*
  * pattern_fill(buf, buflen, pat, patlen, patshift)
  *
@@ -48,7 +58,8 @@ int pattern_check( char * , int , char * , int , int );
  * in the last part of the buffer.  This implies that a buffer which is
  * shorter than the pattern length will receive only a partial pattern ...
  *
- * pattern_fill always returns 0 - no validation of arguments is done.
+ * pattern_fill returns -1 without touching buf if patlen is less than 1,
+ * 0 otherwise - no other validation of arguments is done.
  *
  * The algorithm used to fill the buffer relies on the fact that buf is 
  * supposed to be repeated copies of pattern.  The basic algorithm is
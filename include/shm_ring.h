@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef _SHM_RING_H_
+#define _SHM_RING_H_
+
+/*
+ * Shared memory request rings.  A ring file holds a header followed by
+ * nrings single-producer/single-consumer rings of fixed size records.  The
+ * producer (iogen) maps the file and spreads records over the rings, the
+ * consumers (doio procs) each map it and drain one ring.  Records are moved
+ * in batches, so a batch costs two shared counter updates rather than one
+ * read(2)/write(2) per record.
+ *
+ * The layout of the file is:
+ *
+ *	struct shmr_hdr
+ *	struct shmr_ctl		x nrings
+ *	record slots		x nslots x nrings
+ */
+
+#define SHMR_MAGIC		"SHMRING1"
+#define SHMR_MAX_RINGS		256
+#define SHMR_DEF_SLOTS		1024	/* slots per ring, power of 2	*/
+#define SHMR_CACHELINE		64
+#define SHMR_ATTACH_TIMEOUT	60	/* secs to wait for a consumer	*/
+
+struct shmr_hdr {
+    char		h_magic[8];	/* SHMR_MAGIC once initialized	*/
+    unsigned int	h_nrings;
+    unsigned int	h_nslots;	/* per ring, power of 2		*/
+    unsigned int	h_recsize;	/* bytes per record		*/
+    int			h_producer;	/* pid of the producer		*/
+    unsigned int	h_closed;	/* producer is done		*/
+    char		h_pad[SHMR_CACHELINE - 28];
+};
+
+/*
+ * Producer and consumer counters live on separate cache lines.  Both only
+ * ever increase; the ring is empty when they are equal and full when they
+ * differ by h_nslots.
+ */
+
+struct shmr_ctl {
+    unsigned long long	c_head;		/* next record to be written	*/
+    char		c_pad0[SHMR_CACHELINE - 8];
+    unsigned long long	c_tail;		/* next record to be read	*/
+    int			c_consumer;	/* pid of the consumer		*/
+    char		c_pad1[SHMR_CACHELINE - 12];
+};
+
+/*
+ * Process-local handle returned by shmr_create() and shmr_attach().
+ */
+
+struct shm_ring {
+    struct shmr_hdr	*r_hdr;
+    struct shmr_ctl	*r_ctl;
+    char		*r_slots;
+    size_t		r_len;		/* bytes mapped			*/
+};
+
+#if __STDC__
+extern int	shmr_create(struct shm_ring *ring, char *path, int nrings,
+			    int nslots, int recsize);
+extern int	shmr_attach(struct shm_ring *ring, char *path, int recsize,
+			    int wait);
+extern int	shmr_put(struct shm_ring *ring, int rnum, void *recs,
+			 int nrecs);
+extern int	shmr_get(struct shm_ring *ring, int rnum, void *recs,
+			 int maxrecs);
+extern int	shmr_idle(struct shm_ring *ring, int rnum);
+extern void	shmr_close(struct shm_ring *ring);
+extern void	shmr_detach(struct shm_ring *ring);
+#else
+int	shmr_create();
+int	shmr_attach();
+int	shmr_put();
+int	shmr_get();
+int	shmr_idle();
+void	shmr_close();
+void	shmr_detach();
+#endif
+
+extern char	Shmr_Error_String[];
+
+#endif /* _SHM_RING_H_ */
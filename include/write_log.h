@@ -107,6 +107,36 @@ struct wlog_file {
     char	w_file[1024];		/* name of the write_log	*/
 };
 
+/*
+ * In-core index of a write logfile, mapping each (file, offset) to the
+ * logfile offset of the record which last wrote it.  For every file the
+ * index holds a sorted array of non-overlapping extents, so the most recent
+ * writer of any byte is found with a binary search.  wi_end is the logfile
+ * offset up to which records have been applied; wlog_index_update() only
+ * needs to read the records appended past it.  The index can be saved to,
+ * and loaded from, a checkpoint file next to the logfile (<w_file>.idx).
+ */
+
+struct wlog_extent {
+    long	e_start;		/* first byte written		*/
+    long	e_end;			/* last byte written + 1	*/
+    long	e_recoff;		/* logfile offset of the record	*/
+};
+
+struct wlog_index_file {
+    char		f_path[WLOG_MAX_PATH+1];
+    struct wlog_extent	*f_ext;		/* sorted by e_start		*/
+    int			f_next;		/* # of extents			*/
+    int			f_nalloc;	/* # of extents allocated	*/
+};
+
+struct wlog_index {
+    struct wlog_index_file	*wi_files;	/* sorted by f_path	*/
+    int				wi_nfiles;
+    int				wi_nalloc;
+    long			wi_end;		/* logfile bytes applied */
+};
+
 /*
  * return value defines for the user-supplied function to
  * wlog_scan_backward().
@@ -127,11 +157,30 @@ extern int	wlog_record_write(struct wlog_file *wfile,
 extern int	wlog_scan_backward(struct wlog_file *wfile, int nrecs,
 				   int (*func)(struct wlog_rec *rec, long data),
 				   long data);
+extern int	wlog_record_read(struct wlog_file *wfile, long offset,
+				 struct wlog_rec *wrec);
+extern void	wlog_index_init(struct wlog_index *idx);
+extern void	wlog_index_free(struct wlog_index *idx);
+extern int	wlog_index_update(struct wlog_file *wfile,
+				  struct wlog_index *idx);
+extern long	wlog_index_lookup(struct wlog_index *idx, char *path,
+				  long offset);
+extern int	wlog_index_load(struct wlog_file *wfile,
+				struct wlog_index *idx);
+extern int	wlog_index_save(struct wlog_file *wfile,
+				struct wlog_index *idx);
 #else
 int	wlog_open();
 int	wlog_close();
 int	wlog_record_write();
 int	wlog_scan_backward();
+int	wlog_record_read();
+void	wlog_index_init();
+void	wlog_index_free();
+int	wlog_index_update();
+long	wlog_index_lookup();
+int	wlog_index_load();
+int	wlog_index_save();
 #endif
 
 extern char	Wlog_Error_String[];
@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "dataascii.h"
+#include "pattern.h"
 
 #define CHARS		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghjiklmnopqrstuvwxyz\n"
 #define CHARS_SIZE	sizeof(CHARS)
@@ -23,16 +24,9 @@ dataasciigen(
 	int bsize,
 	int offset)
 {
-	int cnt;
-	int total;
-	int ind;	/* index into CHARS array */
-	char *chr;
 	int chars_size;
 	char *charlist;
 
-	chr=buffer;
-	total=offset+bsize;
-
 	if ( listofchars == NULL ) {
 	    charlist=CHARS;
 	    chars_size=CHARS_SIZE;
@@ -42,10 +36,8 @@ dataasciigen(
 	    chars_size=strlen(listofchars);
 	}
 
-	for(cnt=offset; cnt<total;  cnt++) {
-		ind=cnt%chars_size;
-		*chr++=charlist[ind];
-	}
+	/* the data is the char list repeated, see pattern_fill() */
+	pattern_fill(buffer, bsize, charlist, chars_size, offset % chars_size);
 
 	return bsize;
 
@@ -60,15 +52,10 @@ dataasciichk(
 	char **errmsg)
 {
 	int cnt;
-	int total;
 	int ind;	/* index into CHARS array */
-	char *chr;
 	int chars_size;
 	char *charlist;
 
-	chr=buffer;
-	total=offset+bsize;
-
 	if ( listofchars == NULL ) {
 	    charlist=CHARS;
 	    chars_size=CHARS_SIZE;
@@ -82,14 +69,14 @@ dataasciichk(
 	    *errmsg = Errmsg;
 	}
 
-	for(cnt=offset; cnt<total;  chr++, cnt++) {
-	    ind=cnt%chars_size;
-	    if ( *chr != charlist[ind] ) {
-		sprintf(Errmsg,
-		    "data mismatch at offset %d, exp:%#o, act:%#o", cnt,
-		    charlist[ind], *chr);
-		return cnt;
-	    }
+	cnt = pattern_check_offset(buffer, bsize, charlist, chars_size,
+				   offset % chars_size);
+	if ( cnt >= 0 ) {
+	    ind=(offset+cnt)%chars_size;
+	    sprintf(Errmsg,
+		"data mismatch at offset %d, exp:%#o, act:%#o", offset+cnt,
+		charlist[ind], buffer[cnt]);
+	    return offset+cnt;
 	}
 
 	sprintf(Errmsg, "all %d bytes match desired pattern", bsize);
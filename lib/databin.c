@@ -8,6 +8,7 @@
 #include <string.h> /* memset */
 #include <stdlib.h> /* rand */
 #include "databin.h"
+#include "pattern.h"
 
 #if UNIT_TEST
 #include <malloc.h>
@@ -15,6 +16,9 @@
 
 static char Errmsg[80];
 
+/* the 'C' pattern, repeated from the start of the file */
+static char Counting[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+
 void
 databingen(
 	int mode,	/* either a, c, r, o, z or C */
@@ -36,9 +40,8 @@ databingen(
                 break;
 
 	case 'C':	/* */
-                for (ind=0;ind< bsize;ind++) {
-		    buffer[ind] = ((offset+ind)%8 & 0177);
-		}
+		pattern_fill((char *)buffer, bsize, Counting, sizeof(Counting),
+			     offset % sizeof(Counting));
 		break;
 
 	case 'o':
@@ -71,11 +74,9 @@ databinchk(
 	char **errmsg)
 {
 	int cnt;
-	unsigned char *chr;
-	long expbits;
-	long actbits;
-
-	chr=buffer;
+	unsigned char expbits;
+	char *pat = (char *)&expbits;
+	int patlen = 1;
 
 	if ( errmsg != NULL ) {
 	    *errmsg = Errmsg;
@@ -93,18 +94,9 @@ databinchk(
                 break;
 
 	case 'C':	/* counting pattern */
-                for (cnt=0;cnt< bsize;cnt++) {
-		    expbits = ((offset+cnt)%8 & 0177);
-
-		    if ( buffer[cnt] != expbits ) {
-			sprintf(Errmsg,
-			    "data mismatch at offset %d, exp:%#lo, act:%#o",
-			    offset+cnt, expbits, buffer[cnt]);
-			return offset+cnt;
-		    }
-		}
-		sprintf(Errmsg, "all %d bytes match desired pattern", bsize);
-		return -1;
+		pat = Counting;
+		patlen = sizeof(Counting);
+		break;
 
 	case 'o':
 		expbits=0xff;
@@ -118,14 +110,14 @@ databinchk(
 		return -1;	/* no check can be done for random */
         }
 
-	for (cnt=0; cnt<bsize; chr++, cnt++) {
-	    actbits = (long)*chr;
-
-	    if ( actbits != expbits ) {
-		sprintf(Errmsg, "data mismatch at offset %d, exp:%#lo, act:%#lo",
-		    offset+cnt, expbits, actbits);
-		return offset+cnt;
-	    }
+	/* only the first mismatch is looked for byte by byte */
+	cnt = pattern_check_offset((char *)buffer, bsize, pat, patlen,
+				   offset % patlen);
+	if ( cnt >= 0 ) {
+	    sprintf(Errmsg, "data mismatch at offset %d, exp:%#o, act:%#o",
+		offset+cnt, (unsigned char)pat[(offset+cnt) % patlen],
+		buffer[cnt]);
+	    return offset+cnt;
 	}
 
 	sprintf(Errmsg, "all %d bytes match desired pattern", bsize);
@@ -0,0 +1,416 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Shared memory request rings - see shm_ring.h for the layout.
+ *
+ * Each ring has exactly one producer and one consumer, so the only
+ * synchronization needed is release/acquire ordering on the head and tail
+ * counters.  A side waiting for space or data spins briefly, then backs
+ * off with short sleeps.  A consumer finds EOF when its ring is empty and
+ * the producer has either called shmr_close() or gone away.  A producer
+ * waiting on a ring that no consumer has attached to gives up after
+ * SHMR_ATTACH_TIMEOUT seconds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "shm_ring.h"
+
+#define ERROR_STRING_LEN	1280
+char	Shmr_Error_String[ERROR_STRING_LEN];
+
+#define SHMR_SPINS		64	/* sched_yield()s before sleeping */
+#define SHMR_MAX_SLEEP		1000	/* usecs */
+
+static size_t
+shmr_size(int nrings, int nslots, int recsize)
+{
+	return sizeof(struct shmr_hdr) + nrings * sizeof(struct shmr_ctl) +
+		(size_t)nrings * nslots * recsize;
+}
+
+static void
+shmr_setup(struct shm_ring *ring, void *base, size_t len)
+{
+	ring->r_hdr = (struct shmr_hdr *)base;
+	ring->r_ctl = (struct shmr_ctl *)(ring->r_hdr + 1);
+	ring->r_slots = (char *)(ring->r_ctl + ring->r_hdr->h_nrings);
+	ring->r_len = len;
+}
+
+static char *
+shmr_slot(struct shm_ring *ring, int rnum, unsigned long long seq)
+{
+	struct shmr_hdr	*hdr = ring->r_hdr;
+
+	return ring->r_slots +
+		((size_t)rnum * hdr->h_nslots + (seq & (hdr->h_nslots - 1))) *
+		hdr->h_recsize;
+}
+
+static void
+shmr_backoff(int *waits)
+{
+	int	usecs;
+
+	if (++*waits < SHMR_SPINS) {
+		sched_yield();
+		return;
+	}
+
+	usecs = (*waits - SHMR_SPINS) * 10;
+	if (usecs > SHMR_MAX_SLEEP)
+		usecs = SHMR_MAX_SLEEP;
+	usleep(usecs ? usecs : 1);
+}
+
+/*
+ * Create (or recreate) the ring file at path and map it.  nslots is
+ * rounded up to a power of 2.  The magic is written last, so that
+ * shmr_attach() callers waiting on the file never see a partial header.
+ */
+
+int
+shmr_create(struct shm_ring *ring, char *path, int nrings, int nslots,
+	    int recsize)
+{
+	int		fd, n;
+	size_t		len;
+	void		*base;
+	struct shmr_hdr	*hdr;
+
+	if (nrings < 1 || nrings > SHMR_MAX_RINGS || recsize < 1) {
+		snprintf(Shmr_Error_String, ERROR_STRING_LEN,
+			"Bad ring geometry - %d rings of %d byte records\n",
+			nrings, recsize);
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (n = 1; n < nslots; n <<= 1)
+		;
+	nslots = n;
+	len = shmr_size(nrings, nslots, recsize);
+
+	unlink(path);
+	if ((fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0666)) == -1) {
+		snprintf(Shmr_Error_String, ERROR_STRING_LEN,
+			"Could not create ring file %s:  %s\n",
+			path, strerror(errno));
+		return -1;
+	}
+
+	if (ftruncate(fd, len) == -1) {
+		snprintf(Shmr_Error_String, ERROR_STRING_LEN,
+			"Could not size ring file %s to %lu bytes:  %s\n",
+			path, (unsigned long)len, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		snprintf(Shmr_Error_String, ERROR_STRING_LEN,
+			"Could not mmap ring file %s:  %s\n",
+			path, strerror(errno));
+		return -1;
+	}
+
+	hdr = (struct shmr_hdr *)base;
+	hdr->h_nrings = nrings;
+	hdr->h_nslots = nslots;
+	hdr->h_recsize = recsize;
+	hdr->h_producer = getpid();
+	hdr->h_closed = 0;
+	shmr_setup(ring, base, len);
+
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(hdr->h_magic, SHMR_MAGIC, sizeof(hdr->h_magic));
+	return 0;
+}
+
+/*
+ * Return 1 if every record in all rings has been consumed.
+ */
+
+static int
+shmr_drained(struct shmr_hdr *hdr, struct shmr_ctl *ctl)
+{
+	unsigned int	r;
+
+	for (r = 0; r < hdr->h_nrings; r++)
+		if (__atomic_load_n(&ctl[r].c_tail, __ATOMIC_ACQUIRE) !=
+		    __atomic_load_n(&ctl[r].c_head, __ATOMIC_ACQUIRE))
+			return 0;
+	return 1;
+}
+
+/*
+ * Map an existing ring file.  If wait is set, keep polling until the
+ * producer has created and initialized it; a ring file left behind by a
+ * producer that exited without closing it is treated as not there yet.
+ * A ring file that was closed by a producer which has since exited is
+ * mapped if records are left in it, so a late consumer can still drain
+ * them; once it is fully drained, attaching fails with EPIPE.
+ */
+
+int
+shmr_attach(struct shm_ring *ring, char *path, int recsize, int wait)
+{
+	int		fd;
+	void		*base;
+	struct stat	sbuf;
+	struct shmr_hdr	hdr;
+
+	for (;;) {
+		if ((fd = open(path, O_RDWR)) != -1) {
+			if (fstat(fd, &sbuf) == 0 &&
+			    sbuf.st_size >= (off_t)sizeof(hdr) &&
+			    pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+			    memcmp(hdr.h_magic, SHMR_MAGIC,
+				   sizeof(hdr.h_magic)) == 0 &&
+			    (!wait || hdr.h_closed ||
+			     kill(hdr.h_producer, 0) == 0 || errno != ESRCH))
+				break;
+			close(fd);
+		} else if (errno != ENOENT) {
+			break;
+		}
+
+		if (!wait) {
+			snprintf(Shmr_Error_String, ERROR_STRING_LEN,
+				"%s is not an initialized ring file\n", path);
+			errno = EINVAL;
+			return -1;
+		}
+		usleep(10000);
+	}
+
+	if (fd == -1) {
+		snprintf(Shmr_Error_String, ERROR_STRING_LEN,
+			"Could not open ring file %s:  %s\n",
+			path, strerror(errno));
+		return -1;
+	}
+
+	if (hdr.h_recsize != (unsigned int)recsize ||
+	    hdr.h_nrings < 1 || hdr.h_nrings > SHMR_MAX_RINGS ||
+	    (size_t)sbuf.st_size <
+			shmr_size(hdr.h_nrings, hdr.h_nslots, hdr.h_recsize)) {
+		snprintf(Shmr_Error_String, ERROR_STRING_LEN,
+			"Ring file %s has %u byte records in %u rings, expected %d byte records\n",
+			path, hdr.h_recsize, hdr.h_nrings, recsize);
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	base = mmap(NULL, sbuf.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		snprintf(Shmr_Error_String, ERROR_STRING_LEN,
+			"Could not mmap ring file %s:  %s\n",
+			path, strerror(errno));
+		return -1;
+	}
+
+	shmr_setup(ring, base, sbuf.st_size);
+
+	if (__atomic_load_n(&ring->r_hdr->h_closed, __ATOMIC_ACQUIRE) &&
+	    kill(ring->r_hdr->h_producer, 0) == -1 && errno == ESRCH &&
+	    shmr_drained(ring->r_hdr, ring->r_ctl)) {
+		snprintf(Shmr_Error_String, ERROR_STRING_LEN,
+			"Ring file %s was closed and drained, producer %d has exited\n",
+			path, ring->r_hdr->h_producer);
+		shmr_detach(ring);
+		errno = EPIPE;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Append nrecs records to ring rnum, waiting for the consumer to make room
+ * as needed.  Records are published in as few batches as the free space
+ * allows.  Returns the number of records queued, or -1 with errno set to
+ * EPIPE if the ring is full and its consumer has exited, or to ETIMEDOUT
+ * if it is full and no consumer attached within SHMR_ATTACH_TIMEOUT.
+ */
+
+int
+shmr_put(struct shm_ring *ring, int rnum, void *recs, int nrecs)
+{
+	struct shmr_hdr		*hdr = ring->r_hdr;
+	struct shmr_ctl		*ctl = &ring->r_ctl[rnum];
+	unsigned long long	head, tail, i;
+	char			*rp = (char *)recs;
+	int			done, n, pid, waits;
+	time_t			start = 0;
+
+	head = ctl->c_head;
+	for (done = 0, waits = 0; done < nrecs; ) {
+		tail = __atomic_load_n(&ctl->c_tail, __ATOMIC_ACQUIRE);
+		n = hdr->h_nslots - (head - tail);
+		if (n == 0) {
+			pid = __atomic_load_n(&ctl->c_consumer,
+					      __ATOMIC_RELAXED);
+			if (pid == 0) {
+				if (start == 0) {
+					start = time(NULL);
+				} else if (time(NULL) - start >
+						SHMR_ATTACH_TIMEOUT) {
+					snprintf(Shmr_Error_String,
+						ERROR_STRING_LEN,
+						"No consumer attached to full ring %d in %d seconds\n",
+						rnum, SHMR_ATTACH_TIMEOUT);
+					errno = ETIMEDOUT;
+					return -1;
+				}
+			} else if (kill(pid, 0) == -1 && errno == ESRCH) {
+				snprintf(Shmr_Error_String, ERROR_STRING_LEN,
+					"Consumer %d of ring %d has exited\n",
+					pid, rnum);
+				errno = EPIPE;
+				return -1;
+			}
+			shmr_backoff(&waits);
+			continue;
+		}
+		waits = 0;
+
+		if (n > nrecs - done)
+			n = nrecs - done;
+		for (i = 0; i < (unsigned long long)n; i++) {
+			memcpy(shmr_slot(ring, rnum, head + i), rp,
+			       hdr->h_recsize);
+			rp += hdr->h_recsize;
+		}
+
+		head += n;
+		__atomic_store_n(&ctl->c_head, head, __ATOMIC_RELEASE);
+		done += n;
+	}
+
+	return done;
+}
+
+/*
+ * Take up to maxrecs records from ring rnum, waiting until at least one is
+ * available.  Returns the number of records copied out, or 0 once the ring
+ * is empty and the producer has closed it or exited.
+ */
+
+int
+shmr_get(struct shm_ring *ring, int rnum, void *recs, int maxrecs)
+{
+	struct shmr_hdr		*hdr = ring->r_hdr;
+	struct shmr_ctl		*ctl = &ring->r_ctl[rnum];
+	unsigned long long	head, tail, i;
+	char			*rp = (char *)recs;
+	int			n, waits;
+
+	if (ctl->c_consumer != getpid())
+		__atomic_store_n(&ctl->c_consumer, getpid(), __ATOMIC_RELAXED);
+
+	tail = ctl->c_tail;
+	for (waits = 0; ; ) {
+		head = __atomic_load_n(&ctl->c_head, __ATOMIC_ACQUIRE);
+		if (head != tail)
+			break;
+
+		/*
+		 * Check for EOF only after the ring was seen empty, and
+		 * recheck it afterwards, so that records queued just before
+		 * the producer went away are not lost.
+		 */
+		if (__atomic_load_n(&hdr->h_closed, __ATOMIC_ACQUIRE) ||
+		    (kill(hdr->h_producer, 0) == -1 && errno == ESRCH)) {
+			head = __atomic_load_n(&ctl->c_head, __ATOMIC_ACQUIRE);
+			if (head == tail)
+				return 0;
+			break;
+		}
+		shmr_backoff(&waits);
+	}
+
+	n = head - tail;
+	if (n > maxrecs)
+		n = maxrecs;
+	for (i = 0; i < (unsigned long long)n; i++) {
+		memcpy(rp, shmr_slot(ring, rnum, tail + i), hdr->h_recsize);
+		rp += hdr->h_recsize;
+	}
+
+	__atomic_store_n(&ctl->c_tail, tail + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+/*
+ * Producer side: return 1 if the consumer of ring rnum has taken every
+ * record queued so far, ie. it is (or soon will be) waiting for more.
+ */
+
+int
+shmr_idle(struct shm_ring *ring, int rnum)
+{
+	struct shmr_ctl	*ctl = &ring->r_ctl[rnum];
+
+	return __atomic_load_n(&ctl->c_tail, __ATOMIC_ACQUIRE) == ctl->c_head;
+}
+
+/*
+ * Producer side: mark the rings done so consumers see EOF once drained,
+ * wait for every ring to have a consumer attached and be drained, and
+ * unmap.  Waiting for empty rings too keeps the producer around until each
+ * consumer has attached, so none of them can mistake the ring file for a
+ * stale one.  A ring whose consumer has exited is not waited for, nor is
+ * one that no consumer attached to within SHMR_ATTACH_TIMEOUT.
+ */
+
+void
+shmr_close(struct shm_ring *ring)
+{
+	struct shmr_ctl	*ctl;
+	unsigned int	r;
+	int		pid, waits;
+	time_t		start;
+
+	__atomic_store_n(&ring->r_hdr->h_closed, 1, __ATOMIC_RELEASE);
+
+	start = time(NULL);
+	for (r = 0; r < ring->r_hdr->h_nrings; r++) {
+		ctl = &ring->r_ctl[r];
+		for (waits = 0; ; ) {
+			pid = __atomic_load_n(&ctl->c_consumer,
+					      __ATOMIC_RELAXED);
+			if (pid == 0) {
+				if (time(NULL) - start > SHMR_ATTACH_TIMEOUT)
+					break;
+			} else if (shmr_idle(ring, r) ||
+				   (kill(pid, 0) == -1 && errno == ESRCH)) {
+				break;
+			}
+			shmr_backoff(&waits);
+		}
+	}
+
+	shmr_detach(ring);
+}
+
+void
+shmr_detach(struct shm_ring *ring)
+{
+	munmap(ring->r_hdr, ring->r_len);
+	ring->r_hdr = NULL;
+}
@@ -23,7 +23,9 @@
  * allows the write logfile to contain information on writes which have
  * been initiated, but not yet completed (as in async io).
  *
- * There is also a function to scan a write logfile in reverse order.
+ * There is also a function to scan a write logfile in reverse order, and
+ * a write log index (wlog_index_xxx()) which finds the most recent record
+ * for any file offset without scanning the history.
  *
  * NOTE:	For target file analysis based on a write logfile, the
  * 		assumption is made that the file being written to is
@@ -38,6 +40,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -64,12 +67,17 @@
 #define ERROR_STRING_LEN 1280
 char	Wlog_Error_String[ERROR_STRING_LEN];
 
+#define WLOG_IDX_MAGIC		"WLOGIDX1"	/* index checkpoint magic	*/
+#define WLOG_IDX_SUFFIX		".idx"		/* index checkpoint suffix	*/
+
 #if __STDC__
 static int	wlog_rec_pack(struct wlog_rec *wrec, char *buf, int flag);
 static int	wlog_rec_unpack(struct wlog_rec *wrec, char *buf);
+static void	wlog_index_name(struct wlog_file *wfile, char *name);
 #else
 static int	wlog_rec_pack();
 static int	wlog_rec_unpack();
+static void	wlog_index_name();
 #endif
 
 /*
@@ -112,6 +120,17 @@ wlog_open(struct wlog_file *wfile, int trunc, int mode)
 		return -1;
 	}
 
+	/*
+	 * A truncated logfile invalidates any saved index checkpoint.
+	 */
+
+	if (trunc) {
+		char	name[sizeof(wfile->w_file) + sizeof(WLOG_IDX_SUFFIX)];
+
+		wlog_index_name(wfile, name);
+		unlink(name);
+	}
+
 	/*
 	 * Open the next fd as a random access descriptor
 	 */
@@ -290,7 +309,8 @@ wlog_scan_backward(
 			 * not be word aligned.
 			 */
 
-			reclen = (*(cp-2) * 256) + *(cp -1);
+			reclen = (((unsigned char *)cp)[-2] * 256) +
+				 ((unsigned char *)cp)[-1];
 
 			/*
 			 * If cp-bufstart isn't large enough to hold a
@@ -323,7 +343,7 @@ wlog_scan_backward(
 			 */
 
 			if ((*func)(&wrec, data) == WLOG_STOP_SCAN) {
-				break;
+				return 0;
 			}
 
 			recnum++;
@@ -336,6 +356,434 @@ wlog_scan_backward(
 	return 0;
 }
 
+/*
+ * Read back the record which starts at logfile offset 'offset', as returned
+ * by wlog_record_write() or wlog_index_lookup().
+ */
+
+int
+wlog_record_read(struct wlog_file *wfile, long offset, struct wlog_rec *wrec)
+{
+	int	nbytes;
+	char	albuf[WLOG_REC_MAX_SIZE];
+
+	nbytes = pread(wfile->w_rfd, albuf, sizeof(albuf), offset);
+	if (nbytes < (int)sizeof(struct wlog_rec_disk)) {
+		snprintf(Wlog_Error_String, ERROR_STRING_LEN,
+			"Could not read history record at offset %ld - pread(%d, %p, %d) returned %d:  %s\n",
+			offset, wfile->w_rfd, albuf, (int)sizeof(albuf),
+			nbytes, nbytes < 0 ? strerror(errno) : "short read");
+		return -1;
+	}
+
+	wlog_rec_unpack(wrec, albuf);
+	return 0;
+}
+
+/*
+ * Write log index.  Every record appended to the logfile describes the
+ * byte range [w_offset, w_offset + w_nbytes) of w_path.  Applying records
+ * in logfile order to a per-file extent map leaves, for every byte, the
+ * logfile offset of the last record which wrote it.  The extent arrays are
+ * kept sorted and non-overlapping, so lookups are a binary search and an
+ * update replaces a contiguous run of extents.
+ */
+
+struct wlog_idx_header {
+	char		h_magic[8];
+	long long	h_end;		/* wi_end				*/
+	long long	h_ino;		/* inode # of the logfile		*/
+	int		h_nfiles;
+	int		h_pad;
+};
+
+void
+wlog_index_init(struct wlog_index *idx)
+{
+	bzero((char *)idx, sizeof(*idx));
+}
+
+void
+wlog_index_free(struct wlog_index *idx)
+{
+	int	i;
+
+	for (i = 0; i < idx->wi_nfiles; i++)
+		free(idx->wi_files[i].f_ext);
+	free(idx->wi_files);
+	wlog_index_init(idx);
+}
+
+/*
+ * Find the index entry for path.  If it does not exist and create is set,
+ * insert a new empty entry in sorted position.
+ */
+
+static struct wlog_index_file *
+wlog_index_file(struct wlog_index *idx, char *path, int create)
+{
+	int			lo, hi, mid, cmp;
+	struct wlog_index_file	*f;
+
+	lo = 0;
+	hi = idx->wi_nfiles;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		cmp = strcmp(idx->wi_files[mid].f_path, path);
+		if (cmp == 0)
+			return &idx->wi_files[mid];
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (!create)
+		return NULL;
+
+	if (idx->wi_nfiles == idx->wi_nalloc) {
+		int	nalloc = idx->wi_nalloc ? idx->wi_nalloc * 2 : 16;
+
+		f = realloc(idx->wi_files, nalloc * sizeof(*f));
+		if (f == NULL)
+			return NULL;
+		idx->wi_files = f;
+		idx->wi_nalloc = nalloc;
+	}
+
+	f = &idx->wi_files[lo];
+	memmove(f + 1, f, (idx->wi_nfiles - lo) * sizeof(*f));
+	idx->wi_nfiles++;
+
+	bzero((char *)f, sizeof(*f));
+	snprintf(f->f_path, sizeof(f->f_path), "%s", path);
+	return f;
+}
+
+/*
+ * Return the index of the first extent in f which ends after offset.
+ */
+
+static int
+wlog_extent_search(struct wlog_index_file *f, long offset)
+{
+	int	lo, hi, mid;
+
+	lo = 0;
+	hi = f->f_next;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (f->f_ext[mid].e_end <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Record that [start, end) of f was last written by the record at recoff,
+ * trimming or splitting whatever extents it overlaps.
+ */
+
+static int
+wlog_extent_insert(struct wlog_index_file *f, long start, long end,
+		   long recoff)
+{
+	int			first, last, nnew;
+	struct wlog_extent	left, right, *ep;
+
+	if (start >= end)
+		return 0;
+
+	first = wlog_extent_search(f, start);
+	for (last = first; last < f->f_next && f->f_ext[last].e_start < end;
+	     last++)
+		;
+
+	/*
+	 * Extents [first, last) overlap the new one.  Keep the pieces of
+	 * the first and last of them which stick out on either side.
+	 */
+
+	nnew = 1;
+	left.e_recoff = right.e_recoff = -1;
+	if (first < last && f->f_ext[first].e_start < start) {
+		left = f->f_ext[first];
+		left.e_end = start;
+		nnew++;
+	}
+	if (first < last && f->f_ext[last - 1].e_end > end) {
+		right = f->f_ext[last - 1];
+		right.e_start = end;
+		nnew++;
+	}
+
+	if (f->f_next - (last - first) + nnew > f->f_nalloc) {
+		int	nalloc = f->f_nalloc ? f->f_nalloc * 2 : 16;
+
+		while (nalloc < f->f_next - (last - first) + nnew)
+			nalloc *= 2;
+		ep = realloc(f->f_ext, nalloc * sizeof(*ep));
+		if (ep == NULL)
+			return -1;
+		f->f_ext = ep;
+		f->f_nalloc = nalloc;
+	}
+
+	memmove(&f->f_ext[first + nnew], &f->f_ext[last],
+		(f->f_next - last) * sizeof(*ep));
+	f->f_next += nnew - (last - first);
+
+	ep = &f->f_ext[first];
+	if (left.e_recoff != -1)
+		*ep++ = left;
+	ep->e_start = start;
+	ep->e_end = end;
+	ep->e_recoff = recoff;
+	if (right.e_recoff != -1)
+		*++ep = right;
+
+	return 0;
+}
+
+/*
+ * Apply every complete record appended to the logfile since the last
+ * update.  The logfile is read forward from wi_end; the fixed part of each
+ * record gives the length of the variable part, and the trailing 2-byte
+ * length is checked against it.  A partially written record at EOF is left
+ * for the next update.
+ */
+
+int
+wlog_index_update(struct wlog_file *wfile, struct wlog_index *idx)
+{
+	int			fd, nbytes, reclen, used;
+	long			offset;
+	char			buf[BSIZE*32];
+	unsigned char		*cp;
+	struct wlog_rec		wrec;
+	struct wlog_rec_disk	*wrecd;
+	struct wlog_index_file	*f;
+
+	fd = wfile->w_rfd;
+	offset = idx->wi_end;
+
+	for (;;) {
+		nbytes = pread(fd, buf, sizeof(buf), offset);
+		if (nbytes == -1) {
+			snprintf(Wlog_Error_String, ERROR_STRING_LEN,
+				"Could not read history file at offset %ld - pread(%d, %p, %d) failed:  %s\n",
+				offset, fd, buf, (int)sizeof(buf),
+				strerror(errno));
+			return -1;
+		}
+
+		used = 0;
+		while (nbytes - used >= (int)sizeof(struct wlog_rec_disk)) {
+			wrecd = (struct wlog_rec_disk *)(buf + used);
+			reclen = sizeof(struct wlog_rec_disk) +
+				wrecd->w_pathlen + wrecd->w_hostlen +
+				wrecd->w_patternlen;
+			if (nbytes - used < reclen + 2)
+				break;
+
+			cp = (unsigned char *)buf + used + reclen;
+			if (cp[0] * 256 + cp[1] != reclen) {
+				snprintf(Wlog_Error_String, ERROR_STRING_LEN,
+					"Corrupt history record at offset %ld - length %d, expected %d\n",
+					offset + used, cp[0] * 256 + cp[1],
+					reclen);
+				return -1;
+			}
+
+			wlog_rec_unpack(&wrec, buf + used);
+			if (wrec.w_pathlen > 0) {
+				f = wlog_index_file(idx, wrec.w_path, 1);
+				if (f == NULL ||
+				    wlog_extent_insert(f, wrec.w_offset,
+						       (long)wrec.w_offset +
+						       wrec.w_nbytes,
+						       offset + used) == -1) {
+					snprintf(Wlog_Error_String,
+						ERROR_STRING_LEN,
+						"Could not grow write log index:  %s\n",
+						strerror(errno));
+					return -1;
+				}
+			}
+
+			used += reclen + 2;
+		}
+
+		offset += used;
+		idx->wi_end = offset;
+		if (used == 0)
+			break;
+	}
+
+	return 0;
+}
+
+/*
+ * Return the logfile offset of the most recent record which wrote byte
+ * 'offset' of 'path', or -1 if no indexed record covers it.  Use
+ * wlog_record_read() to fetch the record itself, which also reflects any
+ * later w_done update made in place.
+ */
+
+long
+wlog_index_lookup(struct wlog_index *idx, char *path, long offset)
+{
+	int			i;
+	struct wlog_index_file	*f;
+
+	if ((f = wlog_index_file(idx, path, 0)) == NULL)
+		return -1;
+
+	i = wlog_extent_search(f, offset);
+	if (i == f->f_next || f->f_ext[i].e_start > offset)
+		return -1;
+	return f->f_ext[i].e_recoff;
+}
+
+static void
+wlog_index_name(struct wlog_file *wfile, char *name)
+{
+	snprintf(name, sizeof(wfile->w_file) + sizeof(WLOG_IDX_SUFFIX),
+		 "%s%s", wfile->w_file, WLOG_IDX_SUFFIX);
+}
+
+/*
+ * Checkpoint the index to <w_file>.idx.  The file is written under a
+ * temporary name and renamed into place so that readers never see a
+ * partial checkpoint.
+ */
+
+int
+wlog_index_save(struct wlog_file *wfile, struct wlog_index *idx)
+{
+	int			fd, i, ok;
+	char			name[sizeof(wfile->w_file) + sizeof(WLOG_IDX_SUFFIX)];
+	char			tmp[sizeof(name) + 16];
+	struct stat		sbuf;
+	struct wlog_idx_header	hdr;
+	struct wlog_index_file	*f;
+
+	if (fstat(wfile->w_rfd, &sbuf) == -1) {
+		snprintf(Wlog_Error_String, ERROR_STRING_LEN,
+			"Could not stat write log %s:  %s\n",
+			wfile->w_file, strerror(errno));
+		return -1;
+	}
+
+	wlog_index_name(wfile, name);
+	snprintf(tmp, sizeof(tmp), "%s.%d", name, (int)getpid());
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) {
+		snprintf(Wlog_Error_String, ERROR_STRING_LEN,
+			"Could not create write log index %s:  %s\n",
+			tmp, strerror(errno));
+		return -1;
+	}
+
+	bzero((char *)&hdr, sizeof(hdr));
+	memcpy(hdr.h_magic, WLOG_IDX_MAGIC, sizeof(hdr.h_magic));
+	hdr.h_end = idx->wi_end;
+	hdr.h_ino = sbuf.st_ino;
+	hdr.h_nfiles = idx->wi_nfiles;
+
+	ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr);
+	for (i = 0; ok && i < idx->wi_nfiles; i++) {
+		f = &idx->wi_files[i];
+		ok = write(fd, f->f_path, sizeof(f->f_path)) ==
+				sizeof(f->f_path) &&
+		     write(fd, &f->f_next, sizeof(f->f_next)) ==
+				sizeof(f->f_next) &&
+		     write(fd, f->f_ext, f->f_next * sizeof(*f->f_ext)) ==
+				(ssize_t)(f->f_next * sizeof(*f->f_ext));
+	}
+
+	if (close(fd) == -1)
+		ok = 0;
+	if (!ok || rename(tmp, name) == -1) {
+		snprintf(Wlog_Error_String, ERROR_STRING_LEN,
+			"Could not write write log index %s:  %s\n",
+			name, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Load the checkpoint written by wlog_index_save() into idx, replacing its
+ * contents.  A missing or stale checkpoint (the logfile was recreated or
+ * truncated since) is not an error: idx is left empty, and a subsequent
+ * wlog_index_update() will rebuild it from the start of the logfile.
+ * Either way, only the tail of the logfile past wi_end needs reading.
+ */
+
+int
+wlog_index_load(struct wlog_file *wfile, struct wlog_index *idx)
+{
+	int			fd, i;
+	char			name[sizeof(wfile->w_file) + sizeof(WLOG_IDX_SUFFIX)];
+	struct stat		sbuf;
+	struct wlog_idx_header	hdr;
+	struct wlog_index_file	*f;
+
+	wlog_index_free(idx);
+
+	if (fstat(wfile->w_rfd, &sbuf) == -1) {
+		snprintf(Wlog_Error_String, ERROR_STRING_LEN,
+			"Could not stat write log %s:  %s\n",
+			wfile->w_file, strerror(errno));
+		return -1;
+	}
+
+	wlog_index_name(wfile, name);
+	if ((fd = open(name, O_RDONLY)) == -1)
+		return 0;
+
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    memcmp(hdr.h_magic, WLOG_IDX_MAGIC, sizeof(hdr.h_magic)) != 0 ||
+	    hdr.h_ino != (long long)sbuf.st_ino ||
+	    hdr.h_end > (long long)sbuf.st_size ||
+	    hdr.h_nfiles < 0)
+		goto stale;
+
+	idx->wi_files = calloc(hdr.h_nfiles ? hdr.h_nfiles : 1, sizeof(*f));
+	if (idx->wi_files == NULL)
+		goto stale;
+	idx->wi_nalloc = hdr.h_nfiles;
+
+	for (i = 0; i < hdr.h_nfiles; i++) {
+		f = &idx->wi_files[i];
+		idx->wi_nfiles++;
+		if (read(fd, f->f_path, sizeof(f->f_path)) != sizeof(f->f_path) ||
+		    read(fd, &f->f_next, sizeof(f->f_next)) != sizeof(f->f_next) ||
+		    f->f_next < 0)
+			goto stale;
+		f->f_path[WLOG_MAX_PATH] = '\0';
+		f->f_nalloc = f->f_next;
+		f->f_ext = malloc((f->f_next ? f->f_next : 1) * sizeof(*f->f_ext));
+		if (f->f_ext == NULL ||
+		    read(fd, f->f_ext, f->f_next * sizeof(*f->f_ext)) !=
+				(ssize_t)(f->f_next * sizeof(*f->f_ext)))
+			goto stale;
+	}
+
+	close(fd);
+	idx->wi_end = hdr.h_end;
+	return 0;
+
+stale:
+	close(fd);
+	wlog_index_free(idx);
+	return 0;
+}
+
 /*
  * The following 2 routines are used to pack and unpack the user
  * visible wlog_rec structure to/from a character buffer which is
@@ -24,7 +24,9 @@
 #include <sys/shm.h>	/* for i/o buffer in shared memory */
 #include <sys/wait.h>
 #include <sys/time.h>	/* for delays */
+#include <sys/resource.h>	/* for getrlimit(RLIMIT_NOFILE) */
 #include <ctype.h>
+#include <limits.h>
 
 struct io_req;
 int do_xfsctl(struct io_req *);
@@ -34,6 +36,14 @@ int do_xfsctl(struct io_req *);
 #include "write_log.h"
 #include "random_range.h"
 #include "string_to_tokens.h"
+#include "shm_ring.h"
+
+#ifdef AIO
+#include <libaio.h>
+#endif
+#ifdef URING
+#include <liburing.h>
+#endif
 
 #ifndef O_SSD
 #define O_SSD 0                /* so code compiles on a CRAY2 */
@@ -47,6 +57,7 @@ int do_xfsctl(struct io_req *);
 
 #define PPID_CHECK_INTERVAL 5		/* check ppid every <-- iterations */
 #define	MAX_AIO		256		/* maximum number of async I/O ops */
+#define	DEF_AIO_DEPTH	16		/* default -A, native aio in flight */
 #define	MPP_BUMP	0
 
 
@@ -56,7 +67,7 @@ int do_xfsctl(struct io_req *);
  * getopt() string of supported cmdline arguments.
  */
 
-#define OPTS	"aC:d:ehm:n:kr:w:vU:V:M:N:"
+#define OPTS	"aA:C:d:eF:hm:n:kr:Rw:vU:V:M:N:"
 
 #define DEF_RELEASE_INTERVAL	0
 
@@ -66,13 +77,16 @@ int do_xfsctl(struct io_req *);
  */
 
 int 	a_opt = 0;  	    /* abort on data compare errors 	*/
+int	A_opt = 0;	    /* max # of native async i/os in flight */
 int	e_opt = 0;	    /* exec() after fork()'ing	        */
+int	F_opt = 0;	    /* max # of cached open files	*/
 int	C_opt = 0;	    /* Data Check Type			*/
 int	d_opt = 0;	    /* delay between operations		*/
 int 	k_opt = 0;  	    /* lock file regions during writes	*/
 int	m_opt = 0;	    /* generate periodic messages	*/
 int 	n_opt = 0;  	    /* nprocs	    	    	    	*/
 int 	r_opt = 0;  	    /* resource release interval    	*/
+int	R_opt = 0;	    /* infile is a shared memory ring file */
 int 	w_opt = 0;  	    /* file write log file  	    	*/
 int 	v_opt = 0;  	    /* verify writes if set 	    	*/
 int 	U_opt = 0;  	    /* upanic() on varios conditions	*/
@@ -102,13 +116,27 @@ int	Reqno = 1;	    /* request # - used in some error messages  */
 int	Reqskipcnt = 0;	    /* count of I/O requests that are skipped   */
 int	Validation_Flags;
 char	*(*Data_Check)();   /* function to call for data checking       */
+int	Corrupt_Offset;	    /* 1st bad file offset found by Data_Check  */
 int	(*Data_Fill)();     /* function to call for data filling        */
 int	Nmemalloc = 0;	    /* number of memory allocation strategies   */
 int	delayop = 0;	    /* delay between operations - type of delay */
 int	delaytime = 0;	    /* delay between operations - how long      */
+int	Max_Open_Files = 0; /* fd cache ceiling, 0 = from RLIMIT_NOFILE */
+int	Aio_Depth = DEF_AIO_DEPTH; /* arg to -A			*/
 
 struct wlog_file	Wlog;
 
+/*
+ * Shared memory ring input (-R).  Each doio proc drains its own ring,
+ * Ring_Index, in batches of up to RING_BATCH requests.
+ */
+
+#define RING_BATCH	32
+#define RING_INDEX_ENV	"DOIO_RING_INDEX"	/* Ring_Index across -e exec */
+
+struct shm_ring		Ring;
+int			Ring_Index = 0;
+
 int	active_mmap_rw = 0; /* Indicates that mmapped I/O is occurring. */
 			    /* Used by sigbus_action() in the child doio. */
 int	havesigint = 0;
@@ -164,10 +192,15 @@ struct fd_cache {
 	int	c_maxiosz;
 	void	*c_memaddr;	/* mmapped address */
 	int	c_memlen;	/* length of above region */
+	int	c_aio;		/* # of native async i/os in flight */
+	unsigned int	c_hash;		/* hash of (c_file, c_oflags) */
+	struct fd_cache	*c_hnext;	/* next entry in hash chain */
+	struct fd_cache	*c_lru_prev;	/* more recently used entry */
+	struct fd_cache	*c_lru_next;	/* less recently used entry */
 };
 
-#define FD_ALLOC_INCR	32      /* allocate this many fd_map structs	*/
-				/* at a time */
+#define FD_CACHE_RESERVE 16	/* fds left for stdio, write log, etc.	*/
+#define FD_CACHE_DEFMAX	1024	/* ceiling if RLIMIT_NOFILE is unknown	*/
 
 /*
  * Globals for tracking Sds and Core usage
@@ -205,12 +238,14 @@ char	*format_sds();
 char	*format_listio();
 char	*check_file(char *file, int offset, int length, char *pattern,
 		    int pattern_length, int patshift, int fsa);
+char	*format_wlog_writer(char *file, int offset);
 int	doio_fprintf(FILE *stream, char *format, ...);
 void	doio_upanic(int mask);
 void	doio();
 void	help(FILE *stream);
 void	doio_delay();
 int     alloc_fd( char *, int );
+int	get_ioreq( int, struct io_req * );
 int     alloc_mem( int );
 int     do_read( struct io_req * );
 int     do_write( struct io_req * );
@@ -262,12 +297,45 @@ struct aio_info {
 	int			sig;
 	int			signalled;
 	struct sigaction	osa;
+
+	/*
+	 * Native (A_LIBAIO, A_URING) requests run to completion outside
+	 * of do_rw(), so the slot carries everything aio_complete() needs
+	 * to check the result, verify the data and finish the write-log
+	 * entry.
+	 */
+	struct io_req		req;
+	struct syscall_info	*sy;
+	struct fd_cache		*fdc;
+	char			*buf;		/* private i/o buffer	*/
+	int			buflen;
+	char			*addr;		/* i/o address in buf	*/
+	int			nbytes;
+	int			reqno;
+	int			logged_write;
+	int			woffset;
+	struct wlog_rec		wrec;
+	int			got_lock;
+	int			min_byte;
+	int			max_byte;
+#ifdef AIO
+	struct iocb		iocb;
+#endif
+#ifdef URING
+	struct iovec		iov;
+#endif
 };
 
 struct aio_info	Aio_Info[MAX_AIO];
+int		Aio_Inflight[A_URING + 1];	/* native i/os, by strategy */
 
 struct aio_info	*aio_slot();
 int     aio_done( struct aio_info * );
+struct aio_info	*aio_start(struct io_req *, int, struct fd_cache *, int);
+int	aio_submit(struct aio_info *);
+void	aio_throttle(char *, int, int, int, int);
+void	aio_poll(void);
+void	aio_drain(void);
 
 /* -C data-fill/check type */
 #define	C_DEFAULT	1
@@ -381,6 +449,28 @@ char	**argv;
 		wlog_close(&Wlog);
 	}
 
+	/*
+	 * With -R, wait for iogen to set up the ring file.  There is one ring
+	 * per doio proc, so the number of rings sets the default nprocs.  The
+	 * mapping is inherited by the children.
+	 */
+
+	if (R_opt) {
+		if (shmr_attach(&Ring, Infile, sizeof(struct io_req), 1) == -1) {
+			doio_fprintf(stderr, "%s", Shmr_Error_String);
+			exit(E_SETUP);
+		}
+
+		if (! n_opt) {
+			Nprocs = Ring.r_hdr->h_nrings;
+		} else if (Nprocs != Ring.r_hdr->h_nrings) {
+			doio_fprintf(stderr,
+				     "-n %d does not match the %d rings in %s\n",
+				     Nprocs, Ring.r_hdr->h_nrings, Infile);
+			exit(E_USAGE);
+		}
+	}
+
 	/*
 	 * Malloc space for the children pid array.  Initialize all entries
 	 * to -1.
@@ -423,8 +513,13 @@ char	**argv;
 			Nchildren++;
 			
 			if (pid == 0) {
+				Ring_Index = i;
 				if (e_opt) {
 					char *exec_path;
+					char ring_index[16];
+
+					sprintf(ring_index, "%d", i);
+					setenv(RING_INDEX_ENV, ring_index, 1);
 
 					exec_path = argv[0];
 					argv[0] = (char *)malloc(strlen(exec_path + 1));
@@ -576,10 +671,23 @@ doio()
 	}
 
 	/*
-	 * Open the input stream - either a file or stdin
+	 * Open the input stream - either a file, stdin, or our ring.  A
+	 * re-exec'd child has to map the ring again.
 	 */
 
-	if (Infile == NULL) {
+	if (R_opt) {
+		infd = -1;
+		if (Execd) {
+			char	*cp = getenv(RING_INDEX_ENV);
+
+			Ring_Index = cp ? atoi(cp) : 0;
+			if (shmr_attach(&Ring, Infile, sizeof(struct io_req),
+					1) == -1) {
+				doio_fprintf(stderr, "%s", Shmr_Error_String);
+				exit(E_SETUP);
+			}
+		}
+	} else if (Infile == NULL) {
 		infd = 0;
 	} else {
 		if ((infd = open(Infile, O_RDWR)) == -1) {
@@ -673,7 +781,7 @@ doio()
 	 * Call the appropriate io function based on the request type.
 	 */
 
-	while ((nbytes = read(infd, (char *)&ioreq, sizeof(ioreq)))) {
+	while ((nbytes = get_ioreq(infd, &ioreq))) {
 
 		/*
 		 * Periodically check our ppid.  If it is 1, the child exits to
@@ -727,17 +835,25 @@ doio()
 				alloc_mem(-1);
 #endif
 			}
+			aio_drain();
 			alloc_fd(NULL, 0);
 		}
 
+		/*
+		 * Only do_rw() knows how to run alongside native async i/o,
+		 * everything else waits for it to finish first.
+		 */
+
 		switch (ioreq.r_type) {
 		case READ:
 		case READA:
+			aio_drain();
 			rval = do_read(&ioreq);
 			break;
 
 		case WRITE:
 		case WRITEA:
+			aio_drain();
 			rval = do_write(&ioreq);
 			break;
 
@@ -765,10 +881,12 @@ doio()
 			break;
 		case RESVSP:
 		case UNRESVSP:
+			aio_drain();
 			rval = do_xfsctl(&ioreq);
 			break;
 		case FSYNC2:
 		case FDATASYNC:
+			aio_drain();
 			rval = do_sync(&ioreq);
 			break;
 		default:
@@ -790,6 +908,12 @@ doio()
 			exit(E_SETUP);
 		}
 
+		/*
+		 * Pick up any native async i/o that has completed meanwhile.
+		 */
+
+		aio_poll();
+
 		if (Message_Interval && Reqno % Message_Interval == 0) {
 			doio_fprintf(stderr, "Info:  %d requests done (%d skipped) by this process\n", Reqno, Reqskipcnt);
 		}
@@ -801,8 +925,9 @@ doio()
 	}
 
 	/*
-	 * Child exits normally
+	 * Child exits normally, once its async i/o is done and checked
 	 */
+	aio_drain();
 	alloc_mem(-1);
 	exit(E_NORMAL);
 
@@ -901,6 +1026,8 @@ struct smap aionames[] = {
 	{ "recalls",	A_RECALLS	},
 	{ "suspend",	A_SUSPEND	},
 	{ "callback",	A_CALLBACK	},
+	{ "libaio",	A_LIBAIO	},
+	{ "uring",	A_URING		},
 	{ "synch",	0		},
 	{ "unknown",	-1		},
 };
@@ -945,6 +1072,8 @@ format_strat(int strategy)
 	case A_RECALLS:		aio_strat = "RECALLS";	break;
 	case A_SUSPEND:		aio_strat = "SUSPEND";	break;
 	case A_CALLBACK:	aio_strat = "CALLBACK";	break;
+	case A_LIBAIO:		aio_strat = "LIBAIO";	break;
+	case A_URING:		aio_strat = "URING";	break;
 	case 0:			aio_strat = "<zero>";	break;
 	default:
 		sprintf(msg, "<error:%#o>", strategy);
@@ -1773,6 +1902,16 @@ struct syscall_info syscalls[] = {
 	  SY_WRITE
 	},
 
+	/* native async i/o is submitted by aio_submit() */
+	{ "aread",			AREAD,
+	  NULL,		NULL,		fmt_pread,
+	  SY_ASYNC
+	},
+	{ "awrite",			AWRITE,
+	  NULL,		NULL,		fmt_pread,
+	  SY_WRITE | SY_ASYNC
+	},
+
 	{ NULL,				0,
 	  0,		0,		0,
 	  0
@@ -1787,12 +1926,13 @@ do_rw(req)
 	int	    		fd, offset, nbytes, nstrides, nents, oflags;
 	int			rval, mem_needed, i;
 	int	    		logged_write, got_lock, woffset = 0, pattern;
-	int			min_byte, max_byte;
-	char    		*addr, *file, *msg;
+	int			min_byte = 0, max_byte = 0;
+	char    		*addr, *base, *file, *msg;
 	struct status		*s;
 	struct wlog_rec		wrec;
 	struct syscall_info	*sy;
 	struct fd_cache		*fdc;
+	struct aio_info		*aiop;
 
 	/*
 	 * Initialize common fields - assumes r_oflags, r_file, r_offset, and
@@ -1825,6 +1965,16 @@ do_rw(req)
 		return(-1);
 	}
 
+	/*
+	 * Wait out any native async i/o in flight that overlaps this
+	 * request, and make room for it if it is async itself.  This reaps
+	 * completions, which use the fd cache and Memptr, so it has to be
+	 * done before either is set up for this request.
+	 */
+
+	aio_throttle(file, offset, nbytes*nstrides*nents,
+		     sy->sy_flags & SY_WRITE, sy->sy_flags & SY_ASYNC);
+
 	/*
 	 * Get an open file descriptor
 	 * Note: must be done before memory allocation so that the direct i/o
@@ -1858,6 +2008,21 @@ do_rw(req)
 		return rval;
 	}
 
+	/*
+	 * Async requests stay in flight after we return, so they get a
+	 * buffer of their own instead of Memptr.
+	 */
+
+	aiop = NULL;
+	base = Memptr;
+	if (sy->sy_flags & SY_ASYNC) {
+		aiop = aio_start(req, fd, fdc,
+				 mem_needed + wtob(1) * 2 + fdc->c_memalign);
+		if (aiop == NULL)
+			return -1;
+		base = aiop->buf;
+	}
+
 	Pattern[0] = pattern;
 
 	/*
@@ -1869,7 +2034,7 @@ do_rw(req)
 		fflush(stderr);
 		return -1;
 	} else {
-		addr = Memptr;
+		addr = base;
 
 		/*
 		 * if io is not raw, bump the offset by a random amount
@@ -1892,13 +2057,13 @@ do_rw(req)
 
 		/*
 		 * FILL must be done on a word-aligned buffer.
-		 * Call the fill function with Memptr which is aligned,
+		 * Call the fill function with base which is aligned,
 		 * then memmove it to the right place.
 		 */
 		if (sy->sy_flags & SY_WRITE) {
-			(*Data_Fill)(Memptr, mem_needed, Pattern, Pattern_Length, 0);
-			if( addr != Memptr )
-			    memmove( addr, Memptr, mem_needed);
+			(*Data_Fill)(base, mem_needed, Pattern, Pattern_Length, 0);
+			if( addr != base )
+			    memmove( addr, base, mem_needed);
 		}
 	}
 
@@ -1969,6 +2134,24 @@ do_rw(req)
 		}
 	}
 
+	/*
+	 * Native async i/o is finished by aio_complete(), once it is reaped
+	 * from the request loop or by a later aio_throttle().
+	 */
+
+	if (aiop != NULL) {
+		aiop->sy = sy;
+		aiop->addr = addr;
+		aiop->nbytes = mem_needed;
+		aiop->logged_write = logged_write;
+		aiop->woffset = woffset;
+		aiop->wrec = wrec;
+		aiop->got_lock = got_lock;
+		aiop->min_byte = min_byte;
+		aiop->max_byte = max_byte;
+		return aio_submit(aiop);
+	}
+
 	s = (*sy->sy_syscall)(req, sy, fd, addr);
 
 	if( s->rval == -1 ) {
@@ -2225,59 +2408,49 @@ int	pattern_length;
 int	patshift;
 {
 	static char	errbuf[4096];
-	int		nb, i, pattern_index;
-	char    	*cp, *bufend, *ep;
+	int		nb, i, pattern_index, bad;
+	char    	*cp, *ep;
 	char    	actual[33], expected[33];
 
-	if (pattern_check(buf, length, pattern, pattern_length, patshift) != 0) {
+	bad = pattern_check_offset(buf, length, pattern, pattern_length,
+				   patshift);
+	if (bad != -1) {
 		ep = errbuf;
 		ep += sprintf(ep, "Corrupt regions follow - unprintable chars are represented as '.'\n");
 		ep += sprintf(ep, "-----------------------------------------------------------------\n");
 
-		pattern_index = patshift % pattern_length;;
-		cp = buf;
-		bufend = buf + length;
+		pattern_index = (patshift + bad) % pattern_length;
+		cp = buf + bad;
 
-		while (cp < bufend) {
-			if (*cp != pattern[pattern_index]) {
-				nb = bufend - cp;
-				if (nb > sizeof(expected)-1) {
-					nb = sizeof(expected)-1;
-				}
-			    
-				ep += sprintf(ep, "corrupt bytes starting at file offset %d\n", offset + (int)(cp-buf));
-
-				/*
-				 * Fill in the expected and actual patterns
-				 */
-				bzero(expected, sizeof(expected));
-				bzero(actual, sizeof(actual));
-
-				for (i = 0; i < nb; i++) {
-					expected[i] = pattern[(pattern_index + i) % pattern_length];
-					if (! isprint((int)expected[i])) {
-						expected[i] = '.';
-					}
-
-					actual[i] = cp[i];
-					if (! isprint((int)actual[i])) {
-						actual[i] = '.';
-					}
-				}
+		nb = length - bad;
+		if (nb > sizeof(expected)-1) {
+			nb = sizeof(expected)-1;
+		}
 
-				ep += sprintf(ep, "    1st %2d expected bytes:  %s\n", nb, expected);
-				ep += sprintf(ep, "    1st %2d actual bytes:    %s\n", nb, actual);
-				fflush(stderr);
-				return errbuf;
-			} else {
-				cp++;
-				pattern_index++;
+		ep += sprintf(ep, "corrupt bytes starting at file offset %d\n", offset + bad);
+		Corrupt_Offset = offset + bad;
 
-				if (pattern_index == pattern_length) {
-					pattern_index = 0;
-				}
+		/*
+		 * Fill in the expected and actual patterns
+		 */
+		bzero(expected, sizeof(expected));
+		bzero(actual, sizeof(actual));
+
+		for (i = 0; i < nb; i++) {
+			expected[i] = pattern[(pattern_index + i) % pattern_length];
+			if (! isprint((int)expected[i])) {
+				expected[i] = '.';
+			}
+
+			actual[i] = cp[i];
+			if (! isprint((int)actual[i])) {
+				actual[i] = '.';
 			}
 		}
+
+		ep += sprintf(ep, "    1st %2d expected bytes:  %s\n", nb, expected);
+		ep += sprintf(ep, "    1st %2d actual bytes:    %s\n", nb, actual);
+		fflush(stderr);
 		return errbuf;
 	}
 
@@ -2360,6 +2533,7 @@ int	fsa;
 		return errbuf;
 	}
     
+	Corrupt_Offset = offset;
 	if( (em = (*Data_Check)(buf, offset, length, pattern, pattern_length, patshift)) != NULL ) {
 		ep = errbuf;
 		ep += sprintf(ep, "*** DATA COMPARISON ERROR ***\n");
@@ -2367,12 +2541,55 @@ int	fsa;
 			      file, offset, length, pattern, pattern_length, patshift);
 		ep += sprintf(ep, "Comparison fd is %d, with open flags %#o\n",
 			      fd, flags);
-		strcpy(ep, em);
+		ep += sprintf(ep, "%s", em);
+		if (w_opt)
+			strcpy(ep, format_wlog_writer(file, Corrupt_Offset));
 		return(errbuf);
 	}
 	return NULL;
 }
 
+/*
+ * Describe the most recent logged write of byte 'offset' of 'file', for a
+ * data comparison error report.  The write log index is kept from one call
+ * to the next, so each lookup only reads the records appended since.
+ */
+
+char *
+format_wlog_writer(char *file, int offset)
+{
+	static struct wlog_index	idx;	/* zeroed == wlog_index_init() */
+	static char			buf[512];
+	struct wlog_rec			wrec;
+	long				recoff;
+
+	if (wlog_index_update(&Wlog, &idx) == -1) {
+		snprintf(buf, sizeof(buf),
+			 "Could not update the write log index:  %s",
+			 Wlog_Error_String);
+		return buf;
+	}
+
+	if ((recoff = wlog_index_lookup(&idx, file, offset)) == -1) {
+		snprintf(buf, sizeof(buf),
+			 "No logged write covers offset %d of %s\n",
+			 offset, file);
+		return buf;
+	}
+
+	if (wlog_record_read(&Wlog, recoff, &wrec) == -1) {
+		snprintf(buf, sizeof(buf), "%s", Wlog_Error_String);
+		return buf;
+	}
+
+	snprintf(buf, sizeof(buf),
+		 "Last logged write of offset %d:  pid %d offset %d nbytes %d pattern '%s' host %s (%s)\n",
+		 offset, wrec.w_pid, wrec.w_offset, wrec.w_nbytes,
+		 wrec.w_pattern, wrec.w_host,
+		 wrec.w_done ? "completed" : "not confirmed");
+	return buf;
+}
+
 /*
  * Function to single-thread stdio output.
  */
@@ -2609,18 +2826,55 @@ int nbytes;
 	return 0;
 }
 
+/*
+ * Fetch the next request from the input stream.  Returns the number of
+ * bytes read, 0 at EOF.  Ring input is pulled out in batches and handed
+ * out one request at a time.
+ */
+
+int
+get_ioreq(infd, req)
+int		infd;
+struct io_req	*req;
+{
+	static struct io_req	batch[RING_BATCH];
+	static int		nbatch = 0, next = 0;
+
+	if (! R_opt)
+		return read(infd, (char *)req, sizeof(*req));
+
+	if (next == nbatch) {
+		nbatch = shmr_get(&Ring, Ring_Index, batch, RING_BATCH);
+		next = 0;
+		if (nbatch == 0)
+			return 0;
+	}
+
+	*req = batch[next++];
+	return sizeof(*req);
+}
+
 /*
  * Function to maintain a file descriptor cache, so that doio does not have
  * to do so many open() and close() calls.  Descriptors are stored in the
- * cache by file name, and open flags.  Each entry also has a _rtc value
- * associated with it which is used in aging.  If doio cannot open a file
- * because it already has too many open (ie. system limit hit) it will close
- * the one in the cache that has the oldest _rtc value.
+ * cache by file name, and open flags.  Entries are found through a hash
+ * table keyed on (file, oflags), and are kept on an LRU list which is
+ * reordered on every hit.  If doio cannot open a file because it already
+ * has too many open (ie. system limit hit), or the cache has reached its
+ * ceiling (-F, or derived from RLIMIT_NOFILE), it will close the least
+ * recently used descriptor and reuse its entry.
  *
  * If alloc_fd() is called with a file of NULL, it will close all descriptors
  * in the cache, and free the memory in the cache.
  */
 
+static struct fd_cache	**Fd_Hash;	/* hash buckets			*/
+static unsigned int	Fd_Hash_Mask;	/* # of buckets - 1		*/
+static struct fd_cache	*Fd_Lru_Head;	/* most recently used		*/
+static struct fd_cache	*Fd_Lru_Tail;	/* least recently used		*/
+static int		Fd_Cache_Count;	/* # of entries in the cache	*/
+static int		Fd_Cache_Max;	/* cache ceiling		*/
+
 int
 alloc_fd(file, oflags)
 char	*file;
@@ -2636,74 +2890,191 @@ int	oflags;
 		return(-1);
 }
 
+/*
+ * FNV-1a over the file name, folded with the open flags.
+ */
+
+static unsigned int
+fdcache_hash(char *file, int oflags)
+{
+	unsigned int	h = 2166136261u;
+
+	while (*file) {
+		h ^= (unsigned char)*file++;
+		h *= 16777619u;
+	}
+	h ^= (unsigned int)oflags;
+	h *= 16777619u;
+	return h;
+}
+
+/*
+ * Size the cache ceiling and the hash table.  The ceiling comes from -F if
+ * given, otherwise from the RLIMIT_NOFILE soft limit less a few descriptors
+ * for stdio, the write log and validation opens.
+ */
+
+static void
+fdcache_init(void)
+{
+	struct rlimit	rlim;
+	unsigned int	nbuckets;
+
+	if (Max_Open_Files > 0) {
+		Fd_Cache_Max = Max_Open_Files;
+	} else if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 &&
+		   rlim.rlim_cur != RLIM_INFINITY) {
+		if (rlim.rlim_cur > INT_MAX)
+			rlim.rlim_cur = INT_MAX;
+		Fd_Cache_Max = (int)rlim.rlim_cur - FD_CACHE_RESERVE;
+	} else {
+		Fd_Cache_Max = FD_CACHE_DEFMAX;
+	}
+	if (Fd_Cache_Max < 1)
+		Fd_Cache_Max = 1;
+
+	/* keep chains short: at least one bucket per cached fd */
+	for (nbuckets = 64; nbuckets < (unsigned int)Fd_Cache_Max &&
+	     nbuckets < (1u << 20); nbuckets <<= 1)
+		;
+
+	Fd_Hash = (struct fd_cache **)calloc(nbuckets, sizeof(*Fd_Hash));
+	if (Fd_Hash == NULL) {
+		doio_fprintf(stderr, "Could not malloc() space for fd cache\n");
+		alloc_mem(-1);
+		exit(E_SETUP);
+	}
+	Fd_Hash_Mask = nbuckets - 1;
+}
+
+static void
+fdcache_lru_unlink(struct fd_cache *cp)
+{
+	if (cp->c_lru_prev)
+		cp->c_lru_prev->c_lru_next = cp->c_lru_next;
+	else
+		Fd_Lru_Head = cp->c_lru_next;
+
+	if (cp->c_lru_next)
+		cp->c_lru_next->c_lru_prev = cp->c_lru_prev;
+	else
+		Fd_Lru_Tail = cp->c_lru_prev;
+
+	cp->c_lru_prev = cp->c_lru_next = NULL;
+}
+
+static void
+fdcache_lru_push(struct fd_cache *cp)
+{
+	cp->c_lru_prev = NULL;
+	cp->c_lru_next = Fd_Lru_Head;
+	if (Fd_Lru_Head)
+		Fd_Lru_Head->c_lru_prev = cp;
+	else
+		Fd_Lru_Tail = cp;
+	Fd_Lru_Head = cp;
+}
+
+/*
+ * Close the descriptor held by cp and take it out of the hash table and the
+ * LRU list.  The entry itself is left for the caller to reuse or free.
+ */
+
+static void
+fdcache_evict(struct fd_cache *cp)
+{
+	struct fd_cache	**pp;
+
+	for (pp = &Fd_Hash[cp->c_hash & Fd_Hash_Mask]; *pp != cp;
+	     pp = &(*pp)->c_hnext)
+		;
+	*pp = cp->c_hnext;
+	cp->c_hnext = NULL;
+
+	fdcache_lru_unlink(cp);
+
+	if (cp->c_memaddr != NULL) {
+		munmap(cp->c_memaddr, cp->c_memlen);
+		cp->c_memaddr = NULL;
+		cp->c_memlen = 0;
+	}
+	close(cp->c_fd);
+	cp->c_fd = -1;
+	Fd_Cache_Count--;
+}
+
+/*
+ * Pick the least recently used entry with no native async i/o in flight,
+ * or NULL if every entry is busy.
+ */
+
+static struct fd_cache *
+fdcache_victim(void)
+{
+	struct fd_cache	*cp;
+
+	for (cp = Fd_Lru_Tail; cp != NULL && cp->c_aio; cp = cp->c_lru_prev)
+		;
+	return cp;
+}
+
 struct fd_cache *
 alloc_fdcache(file, oflags)
 char	*file;
 int	oflags;
 {
 	int			fd;
-	struct fd_cache		*free_slot, *oldest_slot, *cp;
-	static int		cache_size = 0;
-	static struct fd_cache	*cache = NULL;
+	unsigned int		hash;
+	struct fd_cache		*free_slot, *cp;
 	struct dioattr	finfo;
 
 	/*
 	 * If file is NULL, it means to free up the fd cache.
 	 */
 
-	if (file == NULL && cache != NULL) {
-		for (cp = cache; cp < &cache[cache_size]; cp++) {
-			if (cp->c_fd != -1) {
-				close(cp->c_fd);
-			}
-			if (cp->c_memaddr != NULL) {
-				munmap(cp->c_memaddr, cp->c_memlen);
-			}
+	if (file == NULL) {
+		while ((cp = Fd_Lru_Head) != NULL) {
+			fdcache_evict(cp);
+			free(cp);
 		}
-
-		free(cache);
-		cache = NULL;
-		cache_size = 0;
-                return 0;
+		return 0;
 	}
 
-	free_slot = NULL;
-	oldest_slot = NULL;
+	if (Fd_Hash == NULL)
+		fdcache_init();
 
 	/*
-	 * Look for a fd in the cache.  If one is found, return it directly.
-	 * Otherwise, when this loop exits, oldest_slot will point to the
-	 * oldest fd slot in the cache, and free_slot will point to an
-	 * unoccupied slot if there are any.
+	 * Look for a fd in the cache.  If one is found, move it to the front
+	 * of the LRU list and return it directly.
 	 */
 
-	for (cp = cache; cp != NULL && cp < &cache[cache_size]; cp++) {
-		if (cp->c_fd != -1 &&
+	hash = fdcache_hash(file, oflags);
+	for (cp = Fd_Hash[hash & Fd_Hash_Mask]; cp != NULL; cp = cp->c_hnext) {
+		if (cp->c_hash == hash &&
 		    cp->c_oflags == oflags &&
 		    strcmp(cp->c_file, file) == 0) {
 			cp->c_rtc = Reqno;
-			return cp;
-		}
-
-		if (cp->c_fd == -1) {
-			if (free_slot == NULL) {
-				free_slot = cp;
-			}
-		} else {
-			if (oldest_slot == NULL || 
-			    cp->c_rtc < oldest_slot->c_rtc) {
-				oldest_slot = cp;
+			if (cp != Fd_Lru_Head) {
+				fdcache_lru_unlink(cp);
+				fdcache_lru_push(cp);
 			}
+			return cp;
 		}
 	}
 
 	/*
-	 * No matching file/oflags pair was found in the cache.  Attempt to
-	 * open a new fd.
+	 * No matching file/oflags pair was found in the cache.  If the cache
+	 * is full, recycle the least recently used entry before opening the
+	 * new fd.
 	 */
 
-	if ((fd = open(file, oflags, 0666)) < 0) {
-		if (errno != EMFILE) {
+	free_slot = NULL;
+	if (Fd_Cache_Count >= Fd_Cache_Max &&
+	    (free_slot = fdcache_victim()) != NULL)
+		fdcache_evict(free_slot);
+
+	while ((fd = open(file, oflags, 0666)) < 0) {
+		if (errno != EMFILE || (cp = fdcache_victim()) == NULL) {
 			doio_fprintf(stderr,
 				     "Could not open file %s with flags %#o (%s): %s (%d)\n",
 				     file, oflags, format_oflags(oflags),
@@ -2714,48 +3085,32 @@ int	oflags;
 
 		/*
 		 * If we get here, we have as many open fd's as we can have.
-		 * Close the oldest one in the cache (pointed to by
-		 * oldest_slot), and attempt to re-open.
+		 * Close the least recently used one in the cache, and
+		 * attempt to re-open.
 		 */
 
-		close(oldest_slot->c_fd);
-		oldest_slot->c_fd = -1;
-		free_slot = oldest_slot;
-
-		if ((fd = open(file, oflags, 0666)) < 0) {
-			doio_fprintf(stderr,
-				     "Could not open file %s with flags %#o (%s):  %s (%d)\n",
-				     file, oflags, format_oflags(oflags),
-				     SYSERR, errno);
-			alloc_mem(-1);
-			exit(E_SETUP);
-		}
+		fdcache_evict(cp);
+		if (free_slot == NULL)
+			free_slot = cp;
+		else
+			free(cp);
 	}
 
 /*printf("alloc_fd: new file %s flags %#o fd %d\n", file, oflags, fd);*/
 
 	/*
 	 * If we get here, fd is our open descriptor.  If free_slot is NULL,
-	 * we need to grow the cache, otherwise free_slot is the slot that
+	 * we need a new entry, otherwise free_slot is a recycled entry that
 	 * should hold the fd info.
 	 */
 
 	if (free_slot == NULL) {
-		cache = (struct fd_cache *)realloc(cache, sizeof(struct fd_cache) * (FD_ALLOC_INCR + cache_size));
-		if (cache == NULL) {
-			doio_fprintf(stderr, "Could not malloc() space for fd chace");
+		free_slot = (struct fd_cache *)malloc(sizeof(struct fd_cache));
+		if (free_slot == NULL) {
+			doio_fprintf(stderr, "Could not malloc() space for fd cache\n");
 			alloc_mem(-1);
 			exit(E_SETUP);
 		}
-
-		cache_size += FD_ALLOC_INCR;
-
-		for (cp = &cache[cache_size-FD_ALLOC_INCR];
-		     cp < &cache[cache_size]; cp++) {
-			cp->c_fd = -1;
-		}
-
-		free_slot = &cache[cache_size - FD_ALLOC_INCR];
 	}
 
 	/*
@@ -2766,6 +3121,11 @@ int	oflags;
 	free_slot->c_oflags = oflags;
 	strcpy(free_slot->c_file, file);
 	free_slot->c_rtc = Reqno;
+	free_slot->c_hash = hash;
+	free_slot->c_hnext = Fd_Hash[hash & Fd_Hash_Mask];
+	Fd_Hash[hash & Fd_Hash_Mask] = free_slot;
+	fdcache_lru_push(free_slot);
+	Fd_Cache_Count++;
 
 	if (oflags & O_DIRECT) {
 		char *dio_env;
@@ -2791,6 +3151,7 @@ int	oflags;
 	free_slot->c_maxiosz = finfo.d_maxiosz;
 	free_slot->c_memaddr = NULL;
 	free_slot->c_memlen = 0;
+	free_slot->c_aio = 0;
 
 	return free_slot;
 }
@@ -2997,6 +3358,450 @@ int	aio_id;
 	return 0;
 }
 
+/*
+ * Native Linux async i/o.  AREAD/AWRITE requests with the A_LIBAIO or
+ * A_URING strategy are submitted straight to the kernel through libaio or
+ * io_uring, and stay in flight while doio goes on with later requests.
+ * Completions are polled for once per pass through the request loop, and
+ * waited for when a new request overlaps one in flight, or more than -A
+ * of them are in flight.  aio_complete() then does what do_rw() does for
+ * a synchronous request - check the byte count, verify the data with
+ * check_file() and finish the write-log entry.
+ */
+
+#ifdef AIO
+static io_context_t	Aio_Ctx;
+static int		Aio_Ctx_Ready = 0;
+#endif
+#ifdef URING
+static struct io_uring	Aio_Ring;
+static int		Aio_Ring_Ready = 0;
+#endif
+
+static int
+aio_native(struct aio_info *aiop)
+{
+	return aiop->busy &&
+	       (aiop->strategy == A_LIBAIO || aiop->strategy == A_URING);
+}
+
+static int
+aio_inflight(void)
+{
+	return Aio_Inflight[A_LIBAIO] + Aio_Inflight[A_URING];
+}
+
+static int
+aio_init(int strategy)
+{
+#if defined(AIO) || defined(URING)
+	int	ret;
+#endif
+
+	switch (strategy) {
+#ifdef AIO
+	case A_LIBAIO:
+		if (Aio_Ctx_Ready)
+			return 0;
+		if ((ret = io_queue_init(MAX_AIO, &Aio_Ctx)) != 0) {
+			doio_fprintf(stderr, "io_queue_init failed:  %s (%d)\n",
+				     strerror(-ret), -ret);
+			return -1;
+		}
+		Aio_Ctx_Ready = 1;
+		return 0;
+#endif
+#ifdef URING
+	case A_URING:
+		if (Aio_Ring_Ready)
+			return 0;
+		if ((ret = io_uring_queue_init(MAX_AIO, &Aio_Ring, 0)) != 0) {
+			doio_fprintf(stderr, "io_uring_queue_init failed:  %s (%d)\n",
+				     strerror(-ret), -ret);
+			return -1;
+		}
+		Aio_Ring_Ready = 1;
+		return 0;
+#endif
+	default:
+		doio_fprintf(stderr,
+			     "async io completion strategy %s is not supported by this doio\n",
+			     format_strat(strategy));
+		return -1;
+	}
+}
+
+/*
+ * Set up a slot for an async request on fd.  A strategy of 0 (iogen's
+ * "none") picks io_uring if doio was built with it, else libaio.  The fd
+ * cache entry is pinned until the request completes, so that it is never
+ * closed under the i/o.
+ */
+
+struct aio_info *
+aio_start(struct io_req *req, int fd, struct fd_cache *fdc, int buflen)
+{
+	struct aio_info	*aiop;
+	char		*buf;
+	int		strategy;
+
+	strategy = req->r_data.io.r_aio_strat;
+	if (strategy == 0) {
+#if defined(URING)
+		strategy = A_URING;
+#elif defined(AIO)
+		strategy = A_LIBAIO;
+#endif
+	}
+
+	if (aio_init(strategy) == -1)
+		return NULL;
+
+	aiop = aio_slot(aio_register(fd, strategy, 0));
+
+	if (aiop->buflen < buflen) {
+		if ((buf = realloc(aiop->buf, buflen)) == NULL) {
+			doio_fprintf(stderr,
+				     "Could not malloc %d bytes for async i/o:  %s (%d)\n",
+				     buflen, SYSERR, errno);
+			aio_unregister(aiop->id);
+			return NULL;
+		}
+		aiop->buf = buf;
+		aiop->buflen = buflen;
+	}
+
+	aiop->req = *req;
+	aiop->reqno = Reqno;
+	aiop->fdc = fdc;
+	fdc->c_aio++;
+	return aiop;
+}
+
+static void
+aio_release(struct aio_info *aiop)
+{
+	aiop->fdc->c_aio--;
+	aio_unregister(aiop->id);
+}
+
+int
+aio_submit(struct aio_info *aiop)
+{
+	struct io_req		*req = &aiop->req;
+	struct syscall_info	*sy = aiop->sy;
+	int			ret;
+#ifdef AIO
+	struct iocb		*iocbp;
+#endif
+#ifdef URING
+	struct io_uring_sqe	*sqe;
+#endif
+
+	switch (aiop->strategy) {
+#ifdef AIO
+	case A_LIBAIO:
+		iocbp = &aiop->iocb;
+		if (sy->sy_flags & SY_WRITE)
+			io_prep_pwrite(iocbp, aiop->fd, aiop->addr,
+				       aiop->nbytes, req->r_data.io.r_offset);
+		else
+			io_prep_pread(iocbp, aiop->fd, aiop->addr,
+				      aiop->nbytes, req->r_data.io.r_offset);
+		iocbp->data = aiop;
+
+		ret = io_submit(Aio_Ctx, 1, &iocbp);
+		if (ret == 1)
+			ret = 0;
+		else if (ret == 0)
+			ret = -EAGAIN;
+		break;
+#endif
+#ifdef URING
+	case A_URING:
+		if ((sqe = io_uring_get_sqe(&Aio_Ring)) == NULL) {
+			ret = -EBUSY;
+			break;
+		}
+		aiop->iov.iov_base = aiop->addr;
+		aiop->iov.iov_len = aiop->nbytes;
+		if (sy->sy_flags & SY_WRITE)
+			io_uring_prep_writev(sqe, aiop->fd, &aiop->iov, 1,
+					     req->r_data.io.r_offset);
+		else
+			io_uring_prep_readv(sqe, aiop->fd, &aiop->iov, 1,
+					    req->r_data.io.r_offset);
+		io_uring_sqe_set_data(sqe, aiop);
+
+		ret = io_uring_submit(&Aio_Ring);
+		if (ret == 1)
+			ret = 0;
+		else if (ret >= 0)
+			ret = -EAGAIN;
+		break;
+#endif
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	if (ret != 0) {
+		errno = -ret;
+		doio_fprintf(stderr,
+			     "%s() submission failed:  %s (%d)\n%s\n%s\n",
+			     sy->sy_name, SYSERR, errno,
+			     fmt_ioreq(req, sy, aiop->fd),
+			     (*sy->sy_format)(req, sy, aiop->fd, aiop->addr));
+		doio_upanic(U_RVAL);
+		aio_release(aiop);
+		return -1;
+	}
+
+	Aio_Inflight[aiop->strategy]++;
+	return 0;
+}
+
+#if defined(AIO) || defined(URING)
+/*
+ * Finish a native async request which completed with result res (bytes
+ * transferred, or -errno).  Errors end the process just as they do when
+ * do_rw() returns them to the request loop.
+ */
+
+static void
+aio_complete(struct aio_info *aiop, long res)
+{
+	struct io_req		*req = &aiop->req;
+	struct syscall_info	*sy = aiop->sy;
+	char			*file = req->r_data.io.r_file;
+	char			*msg;
+	int			reqno;
+
+	Aio_Inflight[aiop->strategy]--;
+
+	/* messages should name the request that completed */
+	reqno = Reqno;
+	Reqno = aiop->reqno;
+
+	if (res < 0) {
+		errno = -res;
+		doio_fprintf(stderr,
+			     "%s() request failed:  %s (%d)\n%s\n%s\n",
+			     sy->sy_name, SYSERR, errno,
+			     fmt_ioreq(req, sy, aiop->fd),
+			     (*sy->sy_format)(req, sy, aiop->fd, aiop->addr));
+		doio_upanic(U_RVAL);
+		alloc_mem(-1);
+		exit(E_SETUP);
+	}
+
+	if (res != aiop->nbytes) {
+		doio_fprintf(stderr,
+			     "%s() request returned wrong # of bytes - expected %d, got %ld\n%s\n%s\n",
+			     sy->sy_name, aiop->nbytes, res,
+			     fmt_ioreq(req, sy, aiop->fd),
+			     (*sy->sy_format)(req, sy, aiop->fd, aiop->addr));
+		doio_upanic(U_RVAL);
+		alloc_mem(-1);
+		exit(E_SETUP);
+	}
+
+	/*
+	 * check_file() reads the data back into Memptr, which may have
+	 * been sized for a smaller request since this one was issued.
+	 */
+
+	if (sy->sy_flags & SY_WRITE && v_opt) {
+		if (alloc_mem(aiop->buflen) < 0) {
+			alloc_mem(-1);
+			exit(E_SETUP);
+		}
+
+		Pattern[0] = req->r_data.io.r_pattern;
+		msg = check_file(file, req->r_data.io.r_offset,
+				 req->r_data.io.r_nbytes,
+				 Pattern, Pattern_Length, 0,
+				 req->r_data.io.r_oflags & O_PARALLEL);
+		if (msg != NULL) {
+			doio_fprintf(stderr, "%s\n%s\n%s\n",
+				     msg,
+				     fmt_ioreq(req, sy, aiop->fd),
+				     (*sy->sy_format)(req, sy, aiop->fd,
+						      aiop->addr));
+			doio_upanic(U_CORRUPTION);
+			exit(E_COMPARE);
+		}
+	}
+
+	if (w_opt && aiop->logged_write) {
+		aiop->wrec.w_done = 1;
+		wlog_record_write(&Wlog, &aiop->wrec, aiop->woffset);
+	}
+
+	if (aiop->got_lock) {
+		if (lock_file_region(file, aiop->fd, F_UNLCK, aiop->min_byte,
+				     (aiop->max_byte-aiop->min_byte+1)) < 0) {
+			alloc_mem(-1);
+			exit(E_INTERNAL);
+		}
+	}
+
+	Reqno = reqno;
+	aio_release(aiop);
+}
+#endif
+
+/*
+ * Reap completed requests of one strategy, waiting until at least min of
+ * them have completed.  Returns the number reaped.
+ */
+
+static int
+aio_reap(int strategy, int min)
+{
+	int			n = 0;
+#ifdef AIO
+	struct io_event		events[MAX_AIO];
+	struct timespec		ts = { 0, 0 };
+	int			i;
+#endif
+#ifdef URING
+	struct io_uring_cqe	*cqe;
+	struct aio_info		*aiop;
+	long			res;
+	int			ret;
+#endif
+
+	switch (strategy) {
+#ifdef AIO
+	case A_LIBAIO:
+		n = io_getevents(Aio_Ctx, min, MAX_AIO, events,
+				 min ? NULL : &ts);
+		if (n == -EINTR)
+			return 0;
+		if (n < 0) {
+			doio_fprintf(stderr, "io_getevents failed:  %s (%d)\n",
+				     strerror(-n), -n);
+			alloc_mem(-1);
+			exit(E_INTERNAL);
+		}
+		for (i = 0; i < n; i++)
+			aio_complete((struct aio_info *)events[i].data,
+				     (long)events[i].res);
+		break;
+#endif
+#ifdef URING
+	case A_URING:
+		for (;;) {
+			if (n < min)
+				ret = io_uring_wait_cqe(&Aio_Ring, &cqe);
+			else
+				ret = io_uring_peek_cqe(&Aio_Ring, &cqe);
+			if (ret == -EAGAIN)
+				break;
+			if (ret == -EINTR)
+				continue;
+			if (ret < 0) {
+				doio_fprintf(stderr,
+					     "io_uring_wait_cqe failed:  %s (%d)\n",
+					     strerror(-ret), -ret);
+				alloc_mem(-1);
+				exit(E_INTERNAL);
+			}
+
+			aiop = (struct aio_info *)io_uring_cqe_get_data(cqe);
+			res = cqe->res;
+			io_uring_cqe_seen(&Aio_Ring, cqe);
+
+			aio_complete(aiop, res);
+			n++;
+		}
+		break;
+#endif
+	default:
+		break;
+	}
+
+	return n;
+}
+
+static void
+aio_wait_slot(struct aio_info *aiop)
+{
+	int	id = aiop->id, strategy = aiop->strategy;
+
+	while (aiop->busy && aiop->id == id)
+		aio_reap(strategy, 1);
+}
+
+/*
+ * Called by do_rw() before it sets up a request.  Waits for any in-flight
+ * request which overlaps [offset, offset+length) of file, unless both are
+ * reads, and for an async request, waits for the oldest ones until fewer
+ * than -A are left in flight.
+ */
+
+void
+aio_throttle(char *file, int offset, int length, int write, int async)
+{
+	struct aio_info	*aiop, *oldest;
+	int		i;
+
+	if (aio_inflight() == 0)
+		return;
+
+	for (i = 0; i < MAX_AIO; i++) {
+		aiop = &Aio_Info[i];
+		if (! aio_native(aiop))
+			continue;
+
+		if ((write || (aiop->sy->sy_flags & SY_WRITE)) &&
+		    aiop->req.r_data.io.r_offset < offset + length &&
+		    offset < aiop->req.r_data.io.r_offset + aiop->nbytes &&
+		    strcmp(aiop->req.r_data.io.r_file, file) == 0)
+			aio_wait_slot(aiop);
+	}
+
+	while (async && aio_inflight() >= Aio_Depth) {
+		oldest = NULL;
+		for (i = 0; i < MAX_AIO; i++) {
+			aiop = &Aio_Info[i];
+			if (aio_native(aiop) &&
+			    (oldest == NULL || aiop->reqno < oldest->reqno))
+				oldest = aiop;
+		}
+		aio_wait_slot(oldest);
+	}
+}
+
+/*
+ * Reap whatever has completed, without waiting.
+ */
+
+void
+aio_poll(void)
+{
+	if (Aio_Inflight[A_LIBAIO])
+		aio_reap(A_LIBAIO, 0);
+	if (Aio_Inflight[A_URING])
+		aio_reap(A_URING, 0);
+}
+
+/*
+ * Wait for all native async i/o to complete.
+ */
+
+void
+aio_drain(void)
+{
+	while (aio_inflight()) {
+		if (Aio_Inflight[A_LIBAIO])
+			aio_reap(A_LIBAIO, Aio_Inflight[A_LIBAIO]);
+		if (Aio_Inflight[A_URING])
+			aio_reap(A_URING, Aio_Inflight[A_URING]);
+	}
+}
+
 #ifndef __linux__
 int
 aio_wait(aio_id)
@@ -3145,6 +3950,28 @@ char	*opts;
 			e_opt++;
 			break;
 
+		case 'A':
+			Aio_Depth = strtol(optarg, &cp, 10);
+			if (*cp != '\0' || Aio_Depth < 1 || Aio_Depth > MAX_AIO) {
+				fprintf(stderr,
+					"%s%s:  Illegal -A arg (%s):  Must be integer between 1 and %d\n",
+					Prog, TagName, optarg, MAX_AIO);
+				exit(E_USAGE);
+			}
+			A_opt++;
+			break;
+
+		case 'F':
+			Max_Open_Files = strtol(optarg, &cp, 10);
+			if (*cp != '\0' || Max_Open_Files < 1) {
+				fprintf(stderr,
+					"%s%s:  Illegal -F arg (%s):  Must be integer > 0\n",
+					Prog, TagName, optarg);
+				exit(E_USAGE);
+			}
+			F_opt++;
+			break;
+
 		case 'h':
 			help(stdout);
 			exit(0);
@@ -3192,6 +4019,10 @@ char	*opts;
 			n_opt++;
 			break;
 
+		case 'R':
+			R_opt++;
+			break;
+
 		case 'r':
 			Release_Interval = strtol(optarg, &cp, 10);
 			if (*cp != '\0' || Release_Interval < 0) {
@@ -3305,6 +4136,12 @@ char	*opts;
 		exit(E_USAGE);
 	}
 
+	if (R_opt && Infile == NULL) {
+		fprintf(stderr, "%s%s:  -R requires a ring file infile\n",
+			Prog, TagName);
+		exit(E_USAGE);
+	}
+
 	return 0;
 }	
 
@@ -3527,7 +4364,7 @@ FILE	*stream;
 		return 0;
 	}
 
-	fprintf(stream, "usage%s:  %s [-aekv] [-m message_interval] [-n nprocs] [-r release_interval] [-w write_log] [-V validation_ftype] [-U upanic_cond] [infile]\n", TagName, Prog);
+	fprintf(stream, "usage%s:  %s [-aekv] [-A aio_depth] [-F max_open_files] [-m message_interval] [-n nprocs] [-r release_interval] [-R] [-w write_log] [-V validation_ftype] [-U upanic_cond] [infile]\n", TagName, Prog);
 	return 0;
 }
 
@@ -3548,6 +4385,9 @@ FILE	*stream;
 	fprintf(stream, "\n");
 	fprintf(stream, "\t-a                   abort - kill all doio processes on data compare\n");
 	fprintf(stream, "\t                     errors.  Normally only the erroring process exits\n");
+	fprintf(stream, "\t-A aio_depth         Maximum number of libaio/io_uring requests\n");
+	fprintf(stream, "\t                     (aread, awrite) each process keeps in flight.\n");
+	fprintf(stream, "\t                     The default is %d.\n", DEF_AIO_DEPTH);
 	fprintf(stream, "\t-C data-pattern-type \n");
 	fprintf(stream, "\t                     Available data patterns are:\n");
 	fprintf(stream, "\t                     default - repeating pattern\n");
@@ -3559,6 +4399,9 @@ FILE	*stream;
 	fprintf(stream, "\t-e                   Re-exec children before entering the main\n");
 	fprintf(stream, "\t                     loop.  This is useful for spreading\n");
 	fprintf(stream, "\t                     procs around on multi-pe systems.\n");
+	fprintf(stream, "\t-F max_open_files   Maximum number of file descriptors kept open\n");
+	fprintf(stream, "\t                     in the fd cache.  The default is derived from\n");
+	fprintf(stream, "\t                     the RLIMIT_NOFILE soft limit.\n");
 	fprintf(stream, "\t-k                   Lock file regions during writes using fcntl()\n");
 	fprintf(stream, "\t-v                   Verify writes - this is done by doing a buffered\n");
 	fprintf(stream, "\t                     read() of the data if file io was done, or\n");
@@ -3585,6 +4428,10 @@ FILE	*stream;
 	fprintf(stream, "\t                     files every release_interval operations.\n");
 	fprintf(stream, "\t                     By default procs never release memory\n");
 	fprintf(stream, "\t                     or close fds unless they have to.\n");
+	fprintf(stream, "\t-R                   infile is a shared memory ring file created by\n");
+	fprintf(stream, "\t                     'iogen -R nrings -p infile'.  doio waits for it\n");
+	fprintf(stream, "\t                     to be created, and runs one proc per ring\n");
+	fprintf(stream, "\t                     unless -n is given, which must then match.\n");
 	fprintf(stream, "\t-V validation_ftype  The type of file descriptor to use for doing data\n");
 	fprintf(stream, "\t                     validation.  validation_ftype may be an octal,\n");
 	fprintf(stream, "\t                     hex, or decimal number representing the open()\n");
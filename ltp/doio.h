@@ -76,6 +76,8 @@
 #define A_RECALLS	5		/* use recalls(2) to wait	*/
 #define	A_SUSPEND	6		/* use aio_suspend(2) to wait	*/
 #define A_CALLBACK	7		/* use a callback signal op.	*/
+#define A_LIBAIO	8		/* io_submit/io_getevents	*/
+#define A_URING		9		/* io_uring submit/cqe polling	*/
 
 /*
  * Define individual structures for each syscall type.  These will all be
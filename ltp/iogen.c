@@ -31,6 +31,7 @@
 #include "string_to_tokens.h"
 #include "open_flags.h"
 #include "random_range.h"
+#include "shm_ring.h"
 
 #ifndef BSIZE
 #define BSIZE 512
@@ -72,7 +73,7 @@ struct strmap {
  * Declare cmdline option flags/variables initialized in parse_cmdline()
  */
 
-#define OPTS	"a:dhf:i:L:m:op:qr:s:t:T:O:N:"
+#define OPTS	"a:dhf:i:L:m:op:qr:R:s:t:T:O:N:"
 
 int	a_opt = 0;		/* async io comp. types supplied	    */
 int 	o_opt = 0;		/* form overlapping requests	    	    */
@@ -85,6 +86,7 @@ int 	p_opt = 0;		/* output pipe - default is stdout	    */
 int 	r_opt = 0;		/* specify raw io multiple instead of	    */
 				/* getting it from the mounted on device.   */
 				/* Only applies to regular files.   	    */
+int	R_opt = 0;		/* output to shared memory rings at -p path */
 int 	s_opt = 0;		/* syscalls	    	    	    	    */
 int 	t_opt = 0;		/* min transfer size (bytes)    	    */
 int 	T_opt = 0;		/* max transfer size (bytes)    	    */
@@ -95,6 +97,7 @@ int 	Iterations;		/* # requests to generate (0 --> infinite)  */
 int 	Time_Mode = 0;		/* non-zero if Iterations is in seconds	    */
 				/* (ie. -i arg was suffixed with 's')       */
 char	*Outpipe;		/* Pipe to write output to if p_opt 	    */
+int	Nrings;			/* # of output rings (doio procs) if R_opt  */
 int 	Mintrans;		/* min io transfer size	    	    	    */
 int 	Maxtrans;		/* max io transfer size	    	    	    */
 int 	Rawmult;		/* raw/ssd io multiple (from -r)    	    */
@@ -132,7 +135,15 @@ struct strmap	Aio_Strat_Map[] = {
 	{ "poll",	A_POLL		},
 	{ "signal",	A_SIGNAL	},
 #else
+#ifdef AIO
+	{ "libaio",	A_LIBAIO	},
+#endif
+#ifdef URING
+	{ "uring",	A_URING		},
+#endif
+#if !defined(AIO) && !defined(URING)
 	{ "none",	0	},
+#endif
 #endif /* !linux */
 	{ NULL,		-1		}
 };
@@ -178,6 +189,10 @@ struct strmap	Syscall_Map[] = {
 	{ "writev",		WRITEV,		SY_WRITE		},
 	{ "mmread",		MMAPR					},
 	{ "mmwrite",		MMAPW,		SY_WRITE		},
+#if defined(AIO) || defined(URING)
+	{ "aread",		AREAD,		SY_ASYNC		},
+	{ "awrite",		AWRITE,		SY_WRITE | SY_ASYNC	},
+#endif
 	{ "fsync2",		FSYNC2, 	SY_WRITE		},
 	{ "fdatasync",		FDATASYNC, 	SY_WRITE		},
 	{ NULL,			-1      }
@@ -218,8 +233,24 @@ char	Byte_Patterns[26] = { 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H',
 			      'Y', 'Z' };
 
 
+/*
+ * Shared memory ring output.  Requests are partitioned over the rings by
+ * file name, so that all requests for a file reach the same doio proc in
+ * the order they were generated, and are queued in batches of up to
+ * RING_BATCH.
+ */
+
+#define RING_BATCH	32
+
+struct shm_ring	Ring;
+struct io_req	(*Ring_Batch)[RING_BATCH];	/* pending requests per ring */
+int		*Ring_Nbatch;			/* # pending per ring	    */
+
 int form_iorequest(struct io_req *);
 int init_output();
+void init_rings();
+void ring_output(struct io_req *req);
+void ring_flush(int rnum);
 int parse_cmdline(int argc, char **argv, char *opts);
 int help(FILE *stream);
 int usage(FILE *stream);
@@ -244,6 +275,9 @@ char	**argv;
      */
     if (! p_opt) {
 	outfd = 1;
+    } else if (R_opt) {
+	outfd = -1;
+	init_rings();
     } else {
 	outfd = init_output();
     }
@@ -277,7 +311,18 @@ char	**argv;
 	}
 
 	req.r_magic = DOIO_MAGIC;
-	write(outfd, (char *)&req, sizeof(req));
+	if (R_opt)
+	    ring_output(&req);
+	else
+	    write(outfd, (char *)&req, sizeof(req));
+    }
+
+    if (R_opt) {
+	int	r;
+
+	for (r = 0; r < Nrings; r++)
+	    ring_flush(r);
+	shmr_close(&Ring);
     }
 
     exit(0);
@@ -297,6 +342,9 @@ startup_info(FILE *stream, int seed)
     fprintf(stream, "Out-pipe:              %s\n", 
 	    p_opt ? Outpipe : "stdout");
 
+    if (R_opt)
+	fprintf(stream, "Out-rings:             %d\n", Nrings);
+
     if (Iterations) {
 	fprintf(stream, "Iterations:            %d", Iterations);
 	if (Time_Mode)
@@ -413,6 +461,79 @@ init_output()
 }
 
 
+/*
+ * Create the shared memory ring file at Outpipe, with one ring per doio
+ * proc.
+ */
+void
+init_rings()
+{
+    if (shmr_create(&Ring, Outpipe, Nrings, SHMR_DEF_SLOTS,
+		    sizeof(struct io_req)) == -1) {
+	fprintf(stderr, "iogen%s:  %s", TagName, Shmr_Error_String);
+	exit(2);
+    }
+
+    Ring_Batch = malloc(Nrings * sizeof(*Ring_Batch));
+    Ring_Nbatch = calloc(Nrings, sizeof(*Ring_Nbatch));
+    if (Ring_Batch == NULL || Ring_Nbatch == NULL) {
+	fprintf(stderr, "iogen%s:  Could not malloc ring batches:  %s\n",
+		TagName, SYSERR);
+	exit(2);
+    }
+}
+
+void
+ring_flush(int rnum)
+{
+    if (Ring_Nbatch[rnum] == 0)
+	return;
+
+    if (shmr_put(&Ring, rnum, Ring_Batch[rnum], Ring_Nbatch[rnum]) == -1) {
+	fprintf(stderr, "iogen%s:  %s", TagName, Shmr_Error_String);
+	exit(2);
+    }
+    Ring_Nbatch[rnum] = 0;
+}
+
+/*
+ * Queue req on the ring owning its file, so that all requests for a file
+ * are done in order by the same doio proc.  ssread/sswrite requests have
+ * no file - their fields overlay r_file - so they all go to ring 0.
+ *
+ * A batch is handed over when it fills up, or earlier once the ring's
+ * consumer has run out of work, so that no doio proc sits idle while
+ * requests for it wait in a partial batch.
+ */
+void
+ring_output(struct io_req *req)
+{
+    unsigned int	h = 2166136261u;
+    unsigned char	*cp;
+    int			r, rnum;
+
+    if (req->r_type == SSREAD || req->r_type == SSWRITE) {
+	rnum = 0;
+    } else {
+	for (cp = (unsigned char *)req->r_data.io.r_file;
+	     cp < (unsigned char *)req->r_data.io.r_file + MAX_FNAME_LENGTH &&
+		*cp;
+	     cp++) {
+	    h ^= *cp;
+	    h *= 16777619u;
+	}
+	rnum = h % Nrings;
+    }
+
+    Ring_Batch[rnum][Ring_Nbatch[rnum]++] = *req;
+    if (Ring_Nbatch[rnum] == RING_BATCH)
+	ring_flush(rnum);
+
+    for (r = 0; r < Nrings; r++)
+	if (Ring_Nbatch[r] && shmr_idle(&Ring, r))
+	    ring_flush(r);
+}
+
 /*
  * Main io generation function.  form_iorequest() selects a system call to
  * do based on cmdline arguments, and proceeds to select parameters for that
@@ -1197,8 +1318,17 @@ char	*opts;
         switch ((char)o) {
 
  	case 'a':
-	    fprintf(stderr, "iogen%s:  Unrecognized option -a on this platform\n", TagName);
-	    exit(2);
+	    cp = strtok(optarg, ",");
+	    while (cp != NULL) {
+		if( (mp = str_lookup(Aio_Strat_Map, cp)) == NULL ) {
+		    fprintf(stderr, "iogen%s:  Unrecognized aio completion type:  %s\n", TagName, cp);
+		    exit(2);
+		}
+
+		cp = strtok(NULL, ",");
+		Aio_Strat_List[Naio_Strat_Types++] = mp;
+	    }
+	    a_opt++;
 	    break;
 
  	case 'f':
@@ -1328,6 +1458,16 @@ char	*opts;
 	    p_opt++;
 	    break;
 
+	case 'R':
+	    Nrings = strtol(optarg, &cp, 10);
+	    if (*cp != '\0' || Nrings < 1 || Nrings > SHMR_MAX_RINGS) {
+		fprintf(stderr, "iogen%s:  Illegal -R arg (%s):  Must be an integer between 1 and %d\n",
+			TagName, optarg, SHMR_MAX_RINGS);
+		exit(1);
+	    }
+	    R_opt++;
+	    break;
+
 	case 'r':
 	    if ((Rawmult = str_to_bytes(optarg)) == -1 ||
 		          Rawmult < 11 || Rawmult % BSIZE) {
@@ -1410,6 +1550,12 @@ char	*opts;
     if( ! O_opt) 
 	Oflags = Ocbits = Ocblks = 0;
 
+    if (R_opt && ! p_opt) {
+	fprintf(stderr, "iogen%s:  -R requires a ring file path with -p\n",
+		TagName);
+	exit(1);
+    }
+
     /*
      * Supply default async io completion strategy types.
      */
@@ -1615,7 +1761,9 @@ FILE	*stream;
     fprintf(stream, "\t                 are:  poll, signal, suspend, and callback.\n");
     fprintf(stream, "\t                 Default is all of the above.\n");
 #else /* !linux */
-    fprintf(stream, "\t-a               (Not used on Linux).\n");
+    fprintf(stream, "\t-a aio_type,...  Async io completion types to choose for aread and\n");
+    fprintf(stream, "\t                 awrite.  Supported types are:  libaio and uring,\n");
+    fprintf(stream, "\t                 as built in.  Default is all of the above.\n");
 #endif /* !linux */
     fprintf(stream, "\t-f flag,...      Flags to use for file IO.  Supported flags are\n");
     fprintf(stream, "\t                 buffered, direct, sync.\n");
@@ -1640,12 +1788,20 @@ FILE	*stream;
     fprintf(stream, "\t                 noreserve - do not reserve with F_RESVSP\n");
     fprintf(stream, "\t                 direct - use O_DIRECT I/O to write to the file\n");
     fprintf(stream, "\t-p               Output pipe.  Default is stdout.\n");
+    fprintf(stream, "\t-R nrings        Write requests to nrings shared memory rings in\n");
+    fprintf(stream, "\t                 a file created at the -p path, instead of a FIFO.\n");
+    fprintf(stream, "\t                 Requests are partitioned over the rings by file\n");
+    fprintf(stream, "\t                 and queued in batches.  Run 'doio -R -n nrings'\n");
+    fprintf(stream, "\t                 on the same path to consume them.\n");
     fprintf(stream, "\t-q               Quiet mode.  Normally iogen spits out info\n");
     fprintf(stream, "\t                 about test files, options, etc. before starting.\n");
     fprintf(stream, "\t-s syscall,...   Syscalls to do.  Supported syscalls are\n");
 #ifdef __linux__
     fprintf(stream, "\t                 read, write, pread, pwrite, readv, writev,\n");
     fprintf(stream, "\t                 mmread, mmwrite, fsync2, fdatasync,\n");
+#if defined(AIO) || defined(URING)
+    fprintf(stream, "\t                 aread, awrite (libaio/io_uring),\n");
+#endif
     fprintf(stream, "\t                 Default is 'read,write,readv,writev,mmread,mmwrite'.\n");
 #endif
     fprintf(stream, "\t-t mintrans      Min transfer length\n");
@@ -1675,6 +1831,6 @@ int
 usage(stream)
 FILE	*stream;
 {
-    fprintf(stream, "usage%s:  iogen [-hoq] [-a aio_type,...] [-f flag[,flag...]] [-i iterations] [-p outpipe] [-m offset-mode] [-s syscall[,syscall...]] [-t mintrans] [-T maxtrans] [ -O file-create-flags ] [[len:]file ...]\n", TagName);
+    fprintf(stream, "usage%s:  iogen [-hoq] [-a aio_type,...] [-f flag[,flag...]] [-i iterations] [-p outpipe] [-R nrings] [-m offset-mode] [-s syscall[,syscall...]] [-t mintrans] [-T maxtrans] [ -O file-create-flags ] [[len:]file ...]\n", TagName);
     return 0;
 }
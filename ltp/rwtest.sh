@@ -17,6 +17,8 @@ Files=""
 Remove_Test_Files=""
 Files_To_Remove=""
 MPPrun=""
+Nrings=""
+Ring=""
 
 usage()
 {
@@ -33,6 +35,9 @@ help()
     -P Places	 Not used
     -S Scenario  Execute an internal scenario.
     -N Name	 Pan-style name to be printed with error messages.
+    -R nrings	 Pass requests from iogen to doio through nrings shared
+		 memory rings (iogen -R, doio -R) instead of a pipe.  doio
+		 runs one proc per ring, so -n, if given, must equal nrings.
 
     Options passed through to iogen:
     -[afiLmOstT] arg
@@ -76,6 +81,11 @@ killkids()
 
 cleanup_and_exit()
 {
+	if [ -n "$Ring" ]
+	then
+		rm -f $Ring
+	fi
+
 	if [ -n "$Remove_Test_Files" ]
 	then
 		if [ -n "$Files_To_Remove" ]
@@ -109,6 +119,10 @@ do	case $1 in
 		shift
 		;;
 
+	-R)	Nrings=$2
+		shift
+		;;
+
 	-S)	Scenario=$2
 		shift
 		opt_S="-S"
@@ -350,7 +364,14 @@ else
 		exit 1
 	fi
 
-	cmd="$IOgen ${iOpts} ${Files} | $MPPrun $doIO ${dOpts}"
+	if [[ -n "$Nrings" ]]; then
+		Ring=${TMPDIR:-/tmp}/rwtest.ring.$$
+		iOpts="$iOpts -p $Ring -R $Nrings"
+		dOpts="$dOpts -R $Ring"
+		cmd="$IOgen ${iOpts} ${Files} & $MPPrun $doIO ${dOpts}"
+	else
+		cmd="$IOgen ${iOpts} ${Files} | $MPPrun $doIO ${dOpts}"
+	fi
 
 	if [[ -z "$Quiet" ]]; then
 		echo $cmd
@@ -359,15 +380,31 @@ else
 	trap "killkids" INT
 	trap "cleanup_and_exit 2" HUP
 
-	( $IOgen ${iOpts} ${Files}
-	  r=$?
-	  if [ $r -ne 0 ]
-	  then
-		echo "$Prog$Name : iogen reported errors (r=$r)" >&2
-		kill -HUP $$
-	  fi
-	) | $MPPrun $doIO ${dOpts}
-	r=$?
+	if [[ -n "$Nrings" ]]; then
+		# doio waits for iogen to create the ring file
+		rm -f $Ring
+		( $IOgen ${iOpts} ${Files}
+		  r=$?
+		  if [ $r -ne 0 ]
+		  then
+			echo "$Prog$Name : iogen reported errors (r=$r)" >&2
+			kill -HUP $$
+		  fi
+		) &
+		$MPPrun $doIO ${dOpts}
+		r=$?
+		wait
+	else
+		( $IOgen ${iOpts} ${Files}
+		  r=$?
+		  if [ $r -ne 0 ]
+		  then
+			echo "$Prog$Name : iogen reported errors (r=$r)" >&2
+			kill -HUP $$
+		  fi
+		) | $MPPrun $doIO ${dOpts}
+		r=$?
+	fi
 	if [ $r -ne 0 ]
 	then
 		echo "$Prog$Name : doio reported errors (r=$r)" >&2
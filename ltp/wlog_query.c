@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Report the most recent write logged by doio -w for byte offsets of a
+ * file.  By default the answer comes from the write log index, which is
+ * loaded from and checkpointed to <logfile>.idx with -c.  -S answers by
+ * scanning the whole logfile backwards instead, so the two can be compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "write_log.h"
+
+extern char	Wlog_Error_String[];
+
+struct query {
+	char		*q_path;
+	long		q_offset;
+	int		q_found;
+	struct wlog_rec	q_rec;
+};
+
+static char	*Prog;
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: %s [-c] [-S] logfile file offset...\n", Prog);
+	fprintf(stderr, "\t-c\tload and save the index checkpoint (<logfile>.idx)\n");
+	fprintf(stderr, "\t-S\tscan the logfile backwards instead of using the index\n");
+	exit(1);
+}
+
+static int
+scan_match(struct wlog_rec *wrec, long data)
+{
+	struct query	*q = (struct query *)data;
+
+	if (strcmp(wrec->w_path, q->q_path) != 0 ||
+	    q->q_offset < wrec->w_offset ||
+	    q->q_offset >= (long)wrec->w_offset + wrec->w_nbytes)
+		return WLOG_CONTINUE_SCAN;
+
+	q->q_rec = *wrec;
+	q->q_found = 1;
+	return WLOG_STOP_SCAN;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct wlog_file	wlog;
+	struct wlog_index	idx;
+	struct query		q;
+	int			c, i, cflag = 0, sflag = 0;
+	long			recoff;
+	char			*end;
+
+	Prog = argv[0];
+	while ((c = getopt(argc, argv, "cS")) != EOF) {
+		switch (c) {
+		case 'c':
+			cflag = 1;
+			break;
+		case 'S':
+			sflag = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc - optind < 3)
+		usage();
+
+	memset(&wlog, 0, sizeof(wlog));
+	snprintf(wlog.w_file, sizeof(wlog.w_file), "%s", argv[optind]);
+	if (wlog_open(&wlog, 0, 0666) == -1) {
+		fprintf(stderr, "%s: %s", Prog, Wlog_Error_String);
+		exit(1);
+	}
+
+	wlog_index_init(&idx);
+	if (!sflag) {
+		if (cflag && wlog_index_load(&wlog, &idx) == -1) {
+			fprintf(stderr, "%s: %s", Prog, Wlog_Error_String);
+			exit(1);
+		}
+		if (wlog_index_update(&wlog, &idx) == -1) {
+			fprintf(stderr, "%s: %s", Prog, Wlog_Error_String);
+			exit(1);
+		}
+		if (cflag && wlog_index_save(&wlog, &idx) == -1) {
+			fprintf(stderr, "%s: %s", Prog, Wlog_Error_String);
+			exit(1);
+		}
+	}
+
+	q.q_path = argv[optind + 1];
+	for (i = optind + 2; i < argc; i++) {
+		q.q_offset = strtol(argv[i], &end, 0);
+		if (*end != '\0' || q.q_offset < 0) {
+			fprintf(stderr, "%s: bad offset %s\n", Prog, argv[i]);
+			exit(1);
+		}
+
+		q.q_found = 0;
+		if (sflag) {
+			if (wlog_scan_backward(&wlog, 0, scan_match,
+					       (long)&q) == -1) {
+				fprintf(stderr, "%s: %s", Prog,
+					Wlog_Error_String);
+				exit(1);
+			}
+		} else if ((recoff = wlog_index_lookup(&idx, q.q_path,
+						       q.q_offset)) != -1) {
+			if (wlog_record_read(&wlog, recoff, &q.q_rec) == -1) {
+				fprintf(stderr, "%s: %s", Prog,
+					Wlog_Error_String);
+				exit(1);
+			}
+			q.q_found = 1;
+		}
+
+		if (!q.q_found) {
+			printf("%s %ld: none\n", q.q_path, q.q_offset);
+			continue;
+		}
+		printf("%s %ld: pid %d offset %d nbytes %d pattern '%s' %s\n",
+		       q.q_path, q.q_offset, q.q_rec.w_pid,
+		       q.q_rec.w_offset, q.q_rec.w_nbytes,
+		       q.q_rec.w_pattern,
+		       q.q_rec.w_done ? "completed" : "not confirmed");
+	}
+
+	wlog_index_free(&idx);
+	wlog_close(&wlog);
+	return 0;
+}
@@ -0,0 +1,310 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Portable implementation of the BLAKE3 hash function, following the
+ * reference implementation in the BLAKE3 specification.  Input is split
+ * into 1 KiB chunks, each chunk is hashed to a chaining value, and the
+ * chaining values are merged pairwise into a binary tree whose pending
+ * left children are kept on a small stack.
+ */
+#include <string.h>
+#include <endian.h>
+#include "blake3.h"
+
+#define CHUNK_START	(1 << 0)
+#define CHUNK_END	(1 << 1)
+#define PARENT		(1 << 2)
+#define ROOT		(1 << 3)
+
+static const uint32_t IV[8] = {
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+	0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+static const uint8_t MSG_SCHEDULE[7][16] = {
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+	{ 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+	{ 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+	{ 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+	{ 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+	{ 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+	{ 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+static inline uint32_t
+rotr32(uint32_t w, int c)
+{
+	return (w >> c) | (w << (32 - c));
+}
+
+#define G(a, b, c, d, x, y)			\
+	do {					\
+		s[a] = s[a] + s[b] + (x);	\
+		s[d] = rotr32(s[d] ^ s[a], 16);	\
+		s[c] = s[c] + s[d];		\
+		s[b] = rotr32(s[b] ^ s[c], 12);	\
+		s[a] = s[a] + s[b] + (y);	\
+		s[d] = rotr32(s[d] ^ s[a], 8);	\
+		s[c] = s[c] + s[d];		\
+		s[b] = rotr32(s[b] ^ s[c], 7);	\
+	} while (0)
+
+/*
+ * Spelled out per round so that the schedule lookups are constants and
+ * the state can live in registers.
+ */
+#define ROUND(r)						\
+	do {							\
+		G(0, 4, 8, 12, m[MSG_SCHEDULE[r][0]],		\
+		  m[MSG_SCHEDULE[r][1]]);			\
+		G(1, 5, 9, 13, m[MSG_SCHEDULE[r][2]],		\
+		  m[MSG_SCHEDULE[r][3]]);			\
+		G(2, 6, 10, 14, m[MSG_SCHEDULE[r][4]],		\
+		  m[MSG_SCHEDULE[r][5]]);			\
+		G(3, 7, 11, 15, m[MSG_SCHEDULE[r][6]],		\
+		  m[MSG_SCHEDULE[r][7]]);			\
+		G(0, 5, 10, 15, m[MSG_SCHEDULE[r][8]],		\
+		  m[MSG_SCHEDULE[r][9]]);			\
+		G(1, 6, 11, 12, m[MSG_SCHEDULE[r][10]],		\
+		  m[MSG_SCHEDULE[r][11]]);			\
+		G(2, 7, 8, 13, m[MSG_SCHEDULE[r][12]],		\
+		  m[MSG_SCHEDULE[r][13]]);			\
+		G(3, 4, 9, 14, m[MSG_SCHEDULE[r][14]],		\
+		  m[MSG_SCHEDULE[r][15]]);			\
+	} while (0)
+
+static void
+load_words(uint32_t *w, const uint8_t *p, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		memcpy(&w[i], p + i * 4, 4);
+		w[i] = le32toh(w[i]);
+	}
+}
+
+/*
+ * Compress one block into the 16 word state s; the first 8 words are the
+ * new chaining value, all 16 are output for the root block.
+ */
+static void
+compress(uint32_t s[16], const uint32_t cv[8], const uint8_t *block,
+	 uint64_t counter, uint32_t block_len, uint32_t flags)
+{
+	uint32_t m[16];
+	int i;
+
+	load_words(m, block, 16);
+	memcpy(s, cv, 8 * sizeof(uint32_t));
+	memcpy(s + 8, IV, 4 * sizeof(uint32_t));
+	s[12] = (uint32_t)counter;
+	s[13] = (uint32_t)(counter >> 32);
+	s[14] = block_len;
+	s[15] = flags;
+
+	ROUND(0);
+	ROUND(1);
+	ROUND(2);
+	ROUND(3);
+	ROUND(4);
+	ROUND(5);
+	ROUND(6);
+
+	for (i = 0; i < 8; i++) {
+		s[i] ^= s[i + 8];
+		s[i + 8] ^= cv[i];
+	}
+}
+
+static void
+compress_cv(uint32_t cv[8], const uint8_t *block, uint64_t counter,
+	    uint32_t block_len, uint32_t flags)
+{
+	uint32_t s[16];
+
+	compress(s, cv, block, counter, block_len, flags);
+	memcpy(cv, s, 8 * sizeof(uint32_t));
+}
+
+/*
+ * Everything needed to produce either a chaining value or root output
+ * from the last block of a chunk or a parent node.
+ */
+struct output {
+	uint32_t	cv[8];
+	uint8_t		block[BLAKE3_BLOCK_LEN];
+	uint64_t	counter;
+	uint32_t	block_len;
+	uint32_t	flags;
+};
+
+static void
+output_cv(const struct output *o, uint32_t cv[8])
+{
+	memcpy(cv, o->cv, sizeof(o->cv));
+	compress_cv(cv, o->block, o->counter, o->block_len, o->flags);
+}
+
+static void
+parent_output(struct output *o, const uint32_t left[8],
+	      const uint32_t right[8])
+{
+	int i;
+
+	memcpy(o->cv, IV, sizeof(o->cv));
+	for (i = 0; i < 8; i++) {
+		uint32_t l = htole32(left[i]);
+		uint32_t r = htole32(right[i]);
+
+		memcpy(o->block + i * 4, &l, 4);
+		memcpy(o->block + 32 + i * 4, &r, 4);
+	}
+	o->counter = 0;
+	o->block_len = BLAKE3_BLOCK_LEN;
+	o->flags = PARENT;
+}
+
+static void
+chunk_init(blake3_chunk_state *cs, uint64_t chunk_counter)
+{
+	memcpy(cs->cv, IV, sizeof(cs->cv));
+	cs->chunk_counter = chunk_counter;
+	cs->buf_len = 0;
+	cs->blocks_compressed = 0;
+}
+
+static size_t
+chunk_len(const blake3_chunk_state *cs)
+{
+	return (size_t)cs->blocks_compressed * BLAKE3_BLOCK_LEN + cs->buf_len;
+}
+
+static uint32_t
+chunk_start_flag(const blake3_chunk_state *cs)
+{
+	return cs->blocks_compressed ? 0 : CHUNK_START;
+}
+
+/*
+ * A block is only compressed once more input for the same chunk shows
+ * up, since the last block of a chunk needs CHUNK_END.  The caller never
+ * passes more than the rest of the chunk.
+ */
+static void
+chunk_update(blake3_chunk_state *cs, const uint8_t *input, size_t len)
+{
+	size_t take;
+
+	while (len) {
+		if (cs->buf_len == BLAKE3_BLOCK_LEN) {
+			compress_cv(cs->cv, cs->buf, cs->chunk_counter,
+				    BLAKE3_BLOCK_LEN, chunk_start_flag(cs));
+			cs->blocks_compressed++;
+			cs->buf_len = 0;
+		}
+		while (cs->buf_len == 0 && len > BLAKE3_BLOCK_LEN) {
+			compress_cv(cs->cv, input, cs->chunk_counter,
+				    BLAKE3_BLOCK_LEN, chunk_start_flag(cs));
+			cs->blocks_compressed++;
+			input += BLAKE3_BLOCK_LEN;
+			len -= BLAKE3_BLOCK_LEN;
+		}
+
+		take = BLAKE3_BLOCK_LEN - cs->buf_len;
+		if (take > len)
+			take = len;
+		memcpy(cs->buf + cs->buf_len, input, take);
+		cs->buf_len += take;
+		input += take;
+		len -= take;
+	}
+}
+
+static void
+chunk_output(const blake3_chunk_state *cs, struct output *o)
+{
+	memcpy(o->cv, cs->cv, sizeof(o->cv));
+	memset(o->block, 0, sizeof(o->block));
+	memcpy(o->block, cs->buf, cs->buf_len);
+	o->counter = cs->chunk_counter;
+	o->block_len = cs->buf_len;
+	o->flags = chunk_start_flag(cs) | CHUNK_END;
+}
+
+void
+blake3_hasher_init(blake3_hasher *self)
+{
+	chunk_init(&self->chunk, 0);
+	self->cv_stack_len = 0;
+}
+
+/*
+ * Push the chaining value of a completed chunk, first merging it with as
+ * many finished subtrees as there are trailing zero bits in the number
+ * of chunks so far.
+ */
+static void
+add_chunk_cv(blake3_hasher *self, uint32_t cv[8], uint64_t total_chunks)
+{
+	struct output o;
+
+	while ((total_chunks & 1) == 0) {
+		parent_output(&o, self->cv_stack[--self->cv_stack_len], cv);
+		output_cv(&o, cv);
+		total_chunks >>= 1;
+	}
+	memcpy(self->cv_stack[self->cv_stack_len++], cv, 8 * sizeof(uint32_t));
+}
+
+void
+blake3_hasher_update(blake3_hasher *self, const void *input, size_t input_len)
+{
+	const uint8_t *p = input;
+	struct output o;
+	uint32_t cv[8];
+	uint64_t total_chunks;
+	size_t take;
+
+	while (input_len) {
+		if (chunk_len(&self->chunk) == BLAKE3_CHUNK_LEN) {
+			chunk_output(&self->chunk, &o);
+			output_cv(&o, cv);
+			total_chunks = self->chunk.chunk_counter + 1;
+			add_chunk_cv(self, cv, total_chunks);
+			chunk_init(&self->chunk, total_chunks);
+		}
+
+		take = BLAKE3_CHUNK_LEN - chunk_len(&self->chunk);
+		if (take > input_len)
+			take = input_len;
+		chunk_update(&self->chunk, p, take);
+		p += take;
+		input_len -= take;
+	}
+}
+
+void
+blake3_hasher_finalize(const blake3_hasher *self, uint8_t *out, size_t out_len)
+{
+	struct output o;
+	uint32_t cv[8];
+	uint32_t s[16];
+	uint64_t counter = 0;
+	int n = self->cv_stack_len;
+	size_t i, take;
+
+	chunk_output(&self->chunk, &o);
+	while (n > 0) {
+		output_cv(&o, cv);
+		parent_output(&o, self->cv_stack[--n], cv);
+	}
+
+	while (out_len) {
+		compress(s, o.cv, o.block, counter++, o.block_len,
+			 o.flags | ROOT);
+		take = out_len < 64 ? out_len : 64;
+		for (i = 0; i < take; i++)
+			*out++ = s[i / 4] >> (8 * (i % 4));
+		out_len -= take;
+	}
+}
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Portable implementation of the BLAKE3 hash function, hash mode only.
+ * See https://github.com/BLAKE3-team/BLAKE3-specs for the specification.
+ */
+#ifndef _BLAKE3_H
+#define _BLAKE3_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLAKE3_OUT_LEN		32
+#define BLAKE3_BLOCK_LEN	64
+#define BLAKE3_CHUNK_LEN	1024
+#define BLAKE3_MAX_DEPTH	54
+
+typedef struct {
+	uint32_t	cv[8];
+	uint64_t	chunk_counter;
+	uint8_t		buf[BLAKE3_BLOCK_LEN];
+	uint8_t		buf_len;
+	uint8_t		blocks_compressed;
+} blake3_chunk_state;
+
+typedef struct {
+	blake3_chunk_state	chunk;
+	uint8_t			cv_stack_len;
+	uint32_t		cv_stack[BLAKE3_MAX_DEPTH][8];
+} blake3_hasher;
+
+extern void blake3_hasher_init(blake3_hasher *self);
+extern void blake3_hasher_update(blake3_hasher *self, const void *input,
+				 size_t input_len);
+extern void blake3_hasher_finalize(const blake3_hasher *self, uint8_t *out,
+				   size_t out_len);
+
+#endif
@@ -17,20 +17,27 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 #include <sys/xattr.h>
+#include "statx.h"
 #ifdef __SOLARIS__
 #include <sys/mkdev.h>
 #endif
 #include "md5.h"
+#include "xxh64.h"
+#include "blake3.h"
 #include <netinet/in.h>
 #include <inttypes.h>
 #include <assert.h>
 #include <endian.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 
-#define CS_SIZE 16
+#define CS_MAX_SIZE 32
 #define CHUNKS	128
 
 #ifdef __linux__
@@ -48,15 +55,127 @@ struct excludes {
 };
 
 typedef struct _sum {
-#ifdef HAVE_OPENSSL
-	EVP_MD_CTX	*ctx;
-#else
-	MD5_CTX 	md5;
-#endif
-	unsigned char	out[16];
+	void		*ctx;
+	unsigned char	out[CS_MAX_SIZE];
 } sum_t;
 
-typedef int (*sum_file_data_t)(int fd, sum_t *dst);
+/*
+ * Digest used for all sums.  The context is allocated by init and freed
+ * by fini, so that a sum_t stays small once it is final.
+ */
+struct sum_algo {
+	const char	*name;
+	int		size;		/* of the digest, in bytes */
+	void		(*init)(sum_t *cs);
+	void		(*add)(sum_t *cs, void *buf, int size);
+	void		(*fini)(sum_t *cs);
+};
+
+/*
+ * The tree is summed by a pool of worker threads.  Listing a directory,
+ * hashing a file and finishing a directory's sum once all of its entries
+ * are done are independent tasks.  The main thread walks the finished
+ * entries in sorted order to write the manifest, so the output is the
+ * same as a serial walk regardless of how the work was scheduled.
+ */
+
+struct sum_dir;
+
+/*
+ * Identity of a regular file's contents for the inode cache (-K).  A
+ * data write always changes ctime, and btime catches a reused inode
+ * number, so matching keys mean the data digest can be reused.
+ */
+struct sum_key {
+	uint64_t	dev;
+	uint64_t	ino;
+	uint64_t	size;
+	uint64_t	mtime_sec;
+	uint64_t	mtime_nsec;
+	uint64_t	ctime_sec;
+	uint64_t	ctime_nsec;
+	uint64_t	btime_sec;
+	uint64_t	btime_nsec;
+};
+
+/*
+ * With -b, file data is summed in fixed size chunks, each of which is a
+ * separate task.  The data sum of the file is then the sum over the
+ * offsets and sums of its chunks, and the chunk sums are written to the
+ * manifest so that -r can tell which byte ranges differ.
+ */
+struct sum_chunk {
+	struct sum_ent	*ent;
+	uint64_t	off;
+	uint64_t	len;
+	int		has_data;	/* not all hole, in strict mode */
+	unsigned char	cs[CS_MAX_SIZE];
+};
+
+struct chunk_list {
+	int		n;
+	int		alloc;
+	struct sum_chunk *c;
+};
+
+struct cache_ent {
+	struct cache_ent	*next;
+	char			*path;		/* escaped */
+	struct sum_key		key;
+	unsigned char		cs[CS_MAX_SIZE];
+};
+
+struct sum_ent {
+	char		*name;
+	char		*path;
+	mode_t		mode;
+	int		skip;		/* excluded or on another device */
+	int		done;		/* cs and meta are final */
+	struct sum_dir	*dir;		/* containing directory, NULL for root */
+	struct sum_dir	*sub;		/* contents, if this is a directory */
+	int		has_key;	/* key is valid and goes to the cache */
+	int		fd;		/* open while chunks are pending */
+	int		chunks_pending;
+	struct chunk_list chunks;
+	struct sum_key	key;
+	sum_t		meta;
+	sum_t		cs;
+};
+
+struct sum_dir {
+	struct sum_ent	*ent;
+	DIR		*d;
+	int		fd;
+	int		level;
+	int		nents;
+	struct sum_ent	*ents;
+	int		listed;		/* ents is filled in */
+	int		pending;	/* entries not done yet, plus one */
+};
+
+enum {
+	TASK_DIR,
+	TASK_FILE,
+	TASK_CHUNK,
+};
+
+struct sum_task {
+	int		type;
+	void		*arg;
+};
+
+/*
+ * Each worker pushes and pops tasks at the tail of its own deque, which
+ * keeps it working depth first.  Idle workers steal from the head of the
+ * other deques, which holds the oldest and usually largest subtrees.
+ */
+struct sum_deque {
+	pthread_mutex_t	lock;
+	struct sum_task	*tasks;
+	int		size;
+	int		head;
+	int		count;
+};
 
 int gen_manifest = 0;
 int in_manifest = 0;
@@ -64,6 +183,15 @@ char *checksum = NULL;
 struct excludes *excludes;
 int n_excludes = 0;
 int verbose = 0;
+int nthreads = 0;
+char *root_path;
+char *cache_file;
+int cache_rehash = 0;
+FILE *cache_fp;
+uint64_t chunk_size = 0;
+int io_depth = 4;
+size_t io_size = 256 * 1024;
+int io_direct = 0;
 FILE *out_fp;
 FILE *in_fp;
 
@@ -154,14 +282,24 @@ usage(void)
 	fprintf(stderr, "    -n           : reset all flags\n");
 	fprintf(stderr, "    -N           : set all flags\n");
 	fprintf(stderr, "    -x path      : exclude path when building checksum (multiple ok)\n");
+	fprintf(stderr, "    -j <threads> : number of threads to walk and hash with (default: number of cpus)\n");
+	fprintf(stderr, "    -H <hash>    : hash to use: md5 (default), xxh64 or blake3\n");
+	fprintf(stderr, "    -K <file>    : reuse data sums of files unchanged since the last run with\n");
+	fprintf(stderr, "                   this cache, and update it\n");
+	fprintf(stderr, "    -F           : with -K, rehash all files but still update the cache\n");
+	fprintf(stderr, "    -b <size>    : sum file data in chunks of size bytes, in parallel, and\n");
+	fprintf(stderr, "                   list the chunk sums in the manifest\n");
+	fprintf(stderr, "    -q <depth>   : reads to keep in flight per thread (default 4)\n");
+	fprintf(stderr, "    -L <size>    : size of each read, a multiple of 64k (default 256k)\n");
+	fprintf(stderr, "    -P           : read file data with O_DIRECT\n");
 	fprintf(stderr, "    -h           : this help\n\n");
 	fprintf(stderr, "The default field mask is ugoamCdtES. If the checksum/manifest is read from a\n");
-	fprintf(stderr, "file, the mask is taken from there and the values given on the command line\n");
-	fprintf(stderr, "are ignored.\n");
+	fprintf(stderr, "file, the mask and hash are taken from there and the values given on the\n");
+	fprintf(stderr, "command line are ignored.\n");
 	exit(-1);
 }
 
-static char buf[65536];
+static __thread char buf[65536];
 
 void *
 alloc(size_t sz)
@@ -177,7 +315,7 @@ alloc(size_t sz)
 }
 
 void
-sum_init(sum_t *cs)
+md5_init(sum_t *cs)
 {
 #ifdef HAVE_OPENSSL
 	cs->ctx = EVP_MD_CTX_new();
@@ -187,36 +325,154 @@ sum_init(sum_t *cs)
 	}
 	EVP_DigestInit(cs->ctx, EVP_md5());
 #else
-	MD5_Init(&cs->md5);
+	cs->ctx = alloc(sizeof(MD5_CTX));
+	MD5_Init(cs->ctx);
 #endif
 }
 
 void
-sum_fini(sum_t *cs)
+md5_fini(sum_t *cs)
 {
 #ifdef HAVE_OPENSSL
 	EVP_DigestFinal(cs->ctx, cs->out, NULL);
 	EVP_MD_CTX_free(cs->ctx);
-	cs->ctx = NULL;
 #else
-	MD5_Final(cs->out, &cs->md5);
+	MD5_Final(cs->out, cs->ctx);
+	free(cs->ctx);
 #endif
+	cs->ctx = NULL;
 }
 
 void
-sum_add(sum_t *cs, void *buf, int size)
+md5_add(sum_t *cs, void *buf, int size)
 {
 #ifdef HAVE_OPENSSL
 	EVP_DigestUpdate(cs->ctx, buf, size);
 #else
-	MD5_Update(&cs->md5, buf, size);
+	MD5_Update(cs->ctx, buf, size);
 #endif
 }
 
+void
+xxh64_sum_init(sum_t *cs)
+{
+	cs->ctx = alloc(sizeof(xxh64_state));
+	xxh64_init(cs->ctx, 0);
+}
+
+void
+xxh64_sum_fini(sum_t *cs)
+{
+	uint64_t h = htobe64(xxh64_digest(cs->ctx));
+
+	memcpy(cs->out, &h, sizeof(h));
+	free(cs->ctx);
+	cs->ctx = NULL;
+}
+
+void
+xxh64_sum_add(sum_t *cs, void *buf, int size)
+{
+	xxh64_update(cs->ctx, buf, size);
+}
+
+void
+blake3_sum_init(sum_t *cs)
+{
+	cs->ctx = alloc(sizeof(blake3_hasher));
+	blake3_hasher_init(cs->ctx);
+}
+
+void
+blake3_sum_fini(sum_t *cs)
+{
+	blake3_hasher_finalize(cs->ctx, cs->out, BLAKE3_OUT_LEN);
+	free(cs->ctx);
+	cs->ctx = NULL;
+}
+
+void
+blake3_sum_add(sum_t *cs, void *buf, int size)
+{
+	blake3_hasher_update(cs->ctx, buf, size);
+}
+
+/* The first entry is the default, and is not named in the output. */
+struct sum_algo sum_algos[] = {
+	{ "md5", 16, md5_init, md5_add, md5_fini },
+	{ "xxh64", XXH64_OUT_LEN, xxh64_sum_init, xxh64_sum_add,
+	  xxh64_sum_fini },
+	{ "blake3", BLAKE3_OUT_LEN, blake3_sum_init, blake3_sum_add,
+	  blake3_sum_fini },
+	{ NULL }
+};
+
+struct sum_algo *algo = &sum_algos[0];
+
+void
+set_algo(char *name)
+{
+	struct sum_algo *a;
+	char *p;
+
+	if ((p = strchr(name, '@'))) {
+		*p++ = 0;
+		chunk_size = strtoull(p, NULL, 10);
+		if (!chunk_size) {
+			fprintf(stderr, "invalid chunk size %s\n", p);
+			exit(-1);
+		}
+	}
+	for (a = sum_algos; a->name; ++a) {
+		if (strcmp(a->name, name) == 0) {
+			algo = a;
+			return;
+		}
+	}
+	fprintf(stderr, "unknown hash %s\n", name);
+	exit(-1);
+}
+
+/*
+ * The hash as named in the output, with the chunk size if there is one.
+ * Returns NULL for plain md5, which is not named.
+ */
+char *
+algo_name(void)
+{
+	static char name[64];
+
+	if (!chunk_size && algo == &sum_algos[0])
+		return NULL;
+	if (!chunk_size)
+		return (char *)algo->name;
+	snprintf(name, sizeof(name), "%s@%llu", algo->name,
+		 (unsigned long long)chunk_size);
+	return name;
+}
+
+void
+sum_init(sum_t *cs)
+{
+	algo->init(cs);
+}
+
+void
+sum_fini(sum_t *cs)
+{
+	algo->fini(cs);
+}
+
+void
+sum_add(sum_t *cs, void *buf, int size)
+{
+	algo->add(cs, buf, size);
+}
+
 void
 sum_add_sum(sum_t *dst, sum_t *src)
 {
-	sum_add(dst, src->out, sizeof(src->out));
+	sum_add(dst, src->out, algo->size);
 }
 
 void
@@ -232,16 +488,57 @@ sum_add_time(sum_t *dst, time_t t)
 	sum_add_u64(dst, t);
 }
 
+void
+sum_to_hex(unsigned char *out, char *s)
+{
+	int i;
+
+	for (i = 0; i < algo->size; ++i)
+		sprintf(s + i * 2, "%02x", out[i]);
+}
+
 char *
 sum_to_string(sum_t *dst)
 {
+	char *s = alloc(algo->size * 2 + 1);
+
+	sum_to_hex(dst->out, s);
+	return s;
+}
+
+int
+parse_sum(char *s, unsigned char *cs)
+{
+	unsigned int v;
 	int i;
-	char *s = alloc(CS_SIZE * 2 + 1);
 
-	for (i = 0; i < CS_SIZE; ++i)
-		sprintf(s + i * 2, "%02x", dst->out[i]);
+	if (strlen(s) != algo->size * 2)
+		return -1;
+	for (i = 0; i < algo->size; ++i) {
+		if (sscanf(s + i * 2, "%2x", &v) != 1)
+			return -1;
+		cs[i] = v;
+	}
+	return 0;
+}
 
-	return s;
+void
+chunk_add(struct chunk_list *cl, uint64_t off, uint64_t len)
+{
+	struct sum_chunk *c;
+
+	if (cl->n == cl->alloc) {
+		cl->alloc += CHUNKS;
+		cl->c = realloc(cl->c, cl->alloc * sizeof(*cl->c));
+		if (!cl->c) {
+			fprintf(stderr, "malloc failed\n");
+			exit(-1);
+		}
+	}
+	c = &cl->c[cl->n++];
+	memset(c, 0, sizeof(*c));
+	c->off = off;
+	c->len = len;
 }
 
 int
@@ -344,48 +641,280 @@ out:
 	return ret;
 }
 
+/*
+ * File data is read by a small pipeline per thread: up to io_depth reads
+ * of io_size bytes are kept in flight ahead of the one being summed,
+ * through io_uring where available.  Otherwise reads are synchronous and
+ * the kernel is asked to read ahead of them.  Each thread owns io_depth
+ * buffers, which bounds the memory used to nthreads * io_depth * io_size.
+ *
+ * In strict mode, the sum includes the offset of each 64k piece of data,
+ * where a piece starts at the next data past the end of the previous one.
+ * The data extents are looked up once each with SEEK_DATA/SEEK_HOLE and
+ * reads cover whole runs of pieces, so the sums do not depend on io_size.
+ */
+
+#define SUM_PIECE	65536
+
+struct io_slot {
+	char		*buf;
+	uint64_t	off;
+	size_t		len;
+	size_t		iolen;		/* len rounded up for O_DIRECT */
+	ssize_t		ret;
+	int		done;
+};
+
+struct io_stream {
+	int		fd;
+	uint64_t	pos;		/* next byte to request */
+	uint64_t	run_end;	/* end of the current run of pieces */
+	uint64_t	end;		/* end of the range to sum */
+	uint64_t	hinted;		/* read ahead requested up to here */
+};
+
+static __thread struct io_slot *io_slots;
+#ifdef HAVE_LIBURING
+static __thread struct io_uring io_ring;
+static __thread int io_ring_state;	/* 0 untried, 1 usable, -1 not */
+#endif
+
+void
+io_setup(void)
+{
+	int i;
+
+	if (io_slots)
+		return;
+	io_slots = alloc(io_depth * sizeof(*io_slots));
+	for (i = 0; i < io_depth; ++i) {
+		if (posix_memalign((void **)&io_slots[i].buf, 4096, io_size)) {
+			fprintf(stderr, "malloc failed\n");
+			exit(-1);
+		}
+	}
+#ifdef HAVE_LIBURING
+	if (io_depth > 1 && io_ring_state == 0)
+		io_ring_state = io_uring_queue_init(io_depth, &io_ring, 0) ?
+				-1 : 1;
+#endif
+}
+
+/*
+ * Get the next read of the range into slot.  Returns 1 if there is one,
+ * 0 at the end of the range, or -errno.
+ */
 int
-sum_file_data_permissive(int fd, sum_t *dst)
+io_next(struct io_stream *st, struct io_slot *slot)
 {
-	int ret;
+	off_t data;
+	off_t hole;
 
-	while (1) {
-		ret = read(fd, buf, sizeof(buf));
+	if (st->pos >= st->end)
+		return 0;
+	if (st->pos >= st->run_end) {
+		data = lseek(st->fd, st->pos, SEEK_DATA);
+		if (data == (off_t)-1)
+			return errno == ENXIO ? 0 : -errno;
+		if (data >= st->end)
+			return 0;
+		hole = lseek(st->fd, data, SEEK_HOLE);
+		if (hole == (off_t)-1)
+			return -errno;
+		st->pos = data;
+		st->run_end = data + (hole - data + SUM_PIECE - 1) /
+				     SUM_PIECE * SUM_PIECE;
+		if (st->run_end > st->end || st->run_end == data)
+			st->run_end = st->end;
+	}
+
+	slot->off = st->pos;
+	slot->len = st->run_end - st->pos < io_size ?
+			st->run_end - st->pos : io_size;
+	slot->iolen = io_direct ? (slot->len + 4095) & ~4095UL : slot->len;
+	slot->ret = 0;
+	st->pos += slot->len;
+	return 1;
+}
+
+void
+io_sum(uint64_t off, char *data, size_t len, sum_t *dst)
+{
+	size_t n;
+
+	if (!flags[FLAG_STRUCTURE]) {
+		sum_add(dst, data, len);
+		return;
+	}
+	for (; len; off += n, data += n, len -= n) {
+		n = len < SUM_PIECE ? len : SUM_PIECE;
+		if (verbose >= 2)
+			fprintf(stderr,
+				"adding to sum at file offset %llu, %zu bytes\n",
+				(unsigned long long)off, n);
+		sum_add_u64(dst, off);
+		sum_add(dst, data, n);
+	}
+}
+
+/*
+ * Do or finish the read of slot.  A short read only means EOF if a plain
+ * read says so too, except for O_DIRECT, which is only short at EOF.
+ * Anything read past the wanted length is dropped.
+ */
+ssize_t
+io_finish(struct io_stream *st, struct io_slot *slot)
+{
+	ssize_t ret;
+
+	while (slot->ret < slot->len) {
+		if (io_direct && slot->ret)
+			break;
+		ret = pread(st->fd, slot->buf + slot->ret,
+			    slot->iolen - slot->ret, slot->off + slot->ret);
 		if (ret < 0)
 			return -errno;
-		sum_add(dst, buf, ret);
-		if (ret < sizeof(buf))
+		if (ret == 0)
 			break;
+		slot->ret += ret;
 	}
-	return 0;
+	if (slot->ret > slot->len)
+		slot->ret = slot->len;
+	return slot->ret;
+}
+
+void
+io_hint(struct io_stream *st, uint64_t off)
+{
+	uint64_t want = off + (uint64_t)io_depth * io_size;
+
+	if (io_direct || io_depth < 2 || want <= st->hinted)
+		return;
+	if (st->hinted < off)
+		st->hinted = off;
+	posix_fadvise(st->fd, st->hinted, want - st->hinted,
+		      POSIX_FADV_WILLNEED);
+	st->hinted = want;
 }
 
 int
-sum_file_data_strict(int fd, sum_t *dst)
+io_sync(struct io_stream *st, sum_t *dst, int *has_data)
 {
+	struct io_slot *slot = &io_slots[0];
 	int ret;
-	off_t pos;
 
-	pos = lseek(fd, 0, SEEK_CUR);
-	if (pos == (off_t)-1)
-		return errno == ENXIO ? 0 : -2;
+	while ((ret = io_next(st, slot)) > 0) {
+		io_hint(st, slot->off + slot->len);
+		if (io_finish(st, slot) < 0)
+			return -errno;
+		io_sum(slot->off, slot->buf, slot->ret, dst);
+		if (slot->ret)
+			*has_data = 1;
+		if (slot->ret < slot->len)
+			return 0;
+	}
+	return ret;
+}
+
+#ifdef HAVE_LIBURING
+int
+io_async(struct io_stream *st, sum_t *dst, int *has_data)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	struct io_slot *slot;
+	int head = 0;
+	int count = 0;
+	int more = 1;		/* more reads to queue */
+	int stop = 0;		/* EOF or error, drain the rest unsummed */
+	int err = 0;
+	int ret;
 
 	while (1) {
-		pos = lseek(fd, pos, SEEK_DATA);
-		if (pos == (off_t)-1)
-			return errno == ENXIO ? 0 : -2;
-		ret = read(fd, buf, sizeof(buf));
-		assert(ret); /* eof found by lseek */
-		if (ret <= 0)
-			return ret;
-		if (verbose >= 2)
-			fprintf(stderr,
-				"adding to sum at file offset %llu, %d bytes\n",
-				(unsigned long long)pos, ret);
-		sum_add_u64(dst, (uint64_t)pos);
-		sum_add(dst, buf, ret);
-		pos += ret;
+		while (more && count < io_depth) {
+			slot = &io_slots[(head + count) % io_depth];
+			ret = io_next(st, slot);
+			if (ret <= 0) {
+				err = ret;
+				more = 0;
+				break;
+			}
+			slot->done = 0;
+			sqe = io_uring_get_sqe(&io_ring);
+			io_uring_prep_read(sqe, st->fd, slot->buf, slot->iolen,
+					   slot->off);
+			io_uring_sqe_set_data(sqe, slot);
+			++count;
+		}
+		if (!count)
+			break;
+		io_uring_submit(&io_ring);
+
+		/* reads complete in any order, but are summed in order */
+		slot = &io_slots[head];
+		while (!slot->done) {
+			ret = io_uring_wait_cqe(&io_ring, &cqe);
+			if (ret < 0) {
+				fprintf(stderr, "io_uring_wait_cqe failed: %s\n",
+					strerror(-ret));
+				exit(-1);
+			}
+			((struct io_slot *)io_uring_cqe_get_data(cqe))->ret =
+				cqe->res;
+			((struct io_slot *)io_uring_cqe_get_data(cqe))->done = 1;
+			io_uring_cqe_seen(&io_ring, cqe);
+		}
+		head = (head + 1) % io_depth;
+		--count;
+		if (stop)
+			continue;
+		if (slot->ret < 0 || io_finish(st, slot) < 0) {
+			err = slot->ret < 0 ? slot->ret : -errno;
+			more = 0;
+			stop = 1;
+			continue;
+		}
+		io_sum(slot->off, slot->buf, slot->ret, dst);
+		if (slot->ret)
+			*has_data = 1;
+		if (slot->ret < slot->len) {
+			more = 0;
+			stop = 1;
+		}
 	}
+	return err;
+}
+#endif
+
+/*
+ * Add the data of fd between start and end to dst.  Sets has_data if
+ * there was any, i.e. the range was not all hole in strict mode.
+ * Returns 0 or -errno.
+ */
+int
+sum_range(int fd, uint64_t start, uint64_t end, sum_t *dst, int *has_data)
+{
+	struct io_stream st;
+	int dummy;
+
+	if (!has_data)
+		has_data = &dummy;
+	*has_data = 0;
+
+	memset(&st, 0, sizeof(st));
+	st.fd = fd;
+	st.pos = start;
+	st.end = end;
+	st.run_end = flags[FLAG_STRUCTURE] ? start : end;
+	io_setup();
+	if (!io_direct && io_depth > 1)
+		posix_fadvise(fd, start, end == UINT64_MAX ? 0 : end - start,
+			      POSIX_FADV_SEQUENTIAL);
+#ifdef HAVE_LIBURING
+	if (io_ring_state == 1)
+		return io_async(&st, dst, has_data);
+#endif
+	return io_sync(&st, dst, has_data);
 }
 
 char *
@@ -438,9 +967,61 @@ pathcmp(const char *a, const char *b)
 	return strcmp(a, b);
 }
 
+void
+print_range(uint64_t *start, uint64_t *end)
+{
+	if (*end > *start)
+		printf("\tbytes %llu-%llu differ\n",
+		       (unsigned long long)*start,
+		       (unsigned long long)*end - 1);
+	*start = *end = 0;
+}
+
+/*
+ * Both sides have chunk sums for a file whose data differs: list the
+ * byte ranges whose chunks differ or exist on one side only, merging
+ * adjacent ones.
+ */
+void
+check_chunks(struct chunk_list *lc, struct chunk_list *rc)
+{
+	struct sum_chunk *c;
+	uint64_t start = 0;
+	uint64_t end = 0;
+	int i = 0;
+	int j = 0;
+
+	while (i < lc->n || j < rc->n) {
+		if (j == rc->n || (i < lc->n && lc->c[i].off < rc->c[j].off)) {
+			c = &lc->c[i++];
+		} else if (i == lc->n || rc->c[j].off < lc->c[i].off) {
+			c = &rc->c[j++];
+		} else {
+			c = &lc->c[i];
+			if (c->len == rc->c[j].len &&
+			    memcmp(c->cs, rc->c[j].cs, algo->size) == 0) {
+				++i;
+				++j;
+				continue;
+			}
+			if (rc->c[j].len > c->len)
+				c = &rc->c[j];
+			++i;
+			++j;
+		}
+		if (c->off != end)
+			print_range(&start, &end);
+		if (end == 0)
+			start = c->off;
+		end = c->off + c->len;
+	}
+	print_range(&start, &end);
+}
+
 void
 check_match(char *fn, char *local_m, char *remote_m,
-	    char *local_c, char *remote_c)
+	    char *local_c, char *remote_c,
+	    struct chunk_list *lc, struct chunk_list *rc)
 {
 	int match_m = !strcmp(local_m, remote_m);
 	int match_c = !strcmp(local_c, remote_c);
@@ -452,14 +1033,61 @@ check_match(char *fn, char *local_m, char *remote_m,
 	} else if (!match_m && !match_c) {
 		printf("metadata and data mismatch in %s\n", fn);
 	}
+	if (!match_c && lc && lc->n && rc->n)
+		check_chunks(lc, rc);
+}
+
+/*
+ * Read the next entry of the manifest into line, along with the chunk
+ * lines that follow it.
+ */
+char *
+get_entry(struct chunk_list *rc)
+{
+	static char next[sizeof(line)];
+	static int have_next;
+	unsigned long long off, len;
+	char cs[2 * CS_MAX_SIZE + 2];
+	char *l;
+
+	rc->n = 0;
+	if (have_next) {
+		strcpy(line, next);
+		have_next = 0;
+		l = line;
+	} else if (!(l = getln(line, sizeof(line), in_fp))) {
+		return NULL;
+	}
+
+	while (getln(next, sizeof(next), in_fp)) {
+		if (next[0] != '+') {
+			have_next = 1;
+			break;
+		}
+		if (sscanf(next, "+%llu %llu %65s", &off, &len, cs) != 3) {
+			fprintf(stderr, "malformed input\n");
+			exit(-1);
+		}
+		chunk_add(rc, off, len);
+		if (parse_sum(cs, rc->c[rc->n - 1].cs)) {
+			fprintf(stderr, "malformed input\n");
+			exit(-1);
+		}
+	}
+
+	return l;
 }
 
 char *prev_fn;
 char *prev_m;
 char *prev_c;
+struct chunk_list prev_chunks;
+struct chunk_list rem_chunks;
 void
-check_manifest(char *fn, char *m, char *c, int last_call)
+check_manifest(char *fn, char *m, char *c, struct chunk_list *lc,
+	       int last_call)
 {
+	struct chunk_list tmp;
 	char *rem_m;
 	char *rem_c;
 	char *l;
@@ -476,7 +1104,7 @@ check_manifest(char *fn, char *m, char *c, int last_call)
 		} else if (cmp < 0) {
 			missing_file(prev_fn);
 		} else {
-			check_match(fn, m, prev_m, c, prev_c);
+			check_match(fn, m, prev_m, c, prev_c, lc, &prev_chunks);
 		}
 		free(prev_fn);
 		free(prev_m);
@@ -487,7 +1115,7 @@ check_manifest(char *fn, char *m, char *c, int last_call)
 		if (cmp == 0)
 			return;
 	}
-	while ((l = getln(line, sizeof(line), in_fp))) {
+	while ((l = get_entry(&rem_chunks))) {
 		rem_c = strrchr(l, ' ');
 		if (!rem_c) {
 			/* final cs */
@@ -510,13 +1138,16 @@ malformed:
 		else
 			cmp = pathcmp(l, fn);
 		if (cmp == 0) {
-			check_match(fn, m, rem_m, c, rem_c);
+			check_match(fn, m, rem_m, c, rem_c, lc, &rem_chunks);
 			return;
 		} else if (cmp > 0) {
 			excess_file(fn);
 			prev_fn = strdup(l);
 			prev_m = strdup(rem_m);
 			prev_c = strdup(rem_c); 
+			tmp = prev_chunks;
+			prev_chunks = rem_chunks;
+			rem_chunks = tmp;
 			return;
 		}
 		missing_file(l);
@@ -525,10 +1156,489 @@ malformed:
 		excess_file(fn);
 }
 
+/*
+ * The inode cache holds one line per regular file of the last run,
+ *
+ *	<path> <dev> <ino> <size> <mtime> <ctime> <btime> <data sum>
+ *
+ * with times as seconds.nanoseconds, after a "Cache: <flags> <hash>"
+ * header.  A cache written with other flags or another hash is ignored.
+ * It is loaded before the walk and only read during it; the main thread
+ * writes the new one as it emits entries.
+ */
+struct cache_ent **cache_tab;
+unsigned int cache_tab_size;
+unsigned long cache_hits;
+unsigned long cache_misses;
+
+unsigned int
+cache_hash(const char *s)
+{
+	unsigned int h = 2166136261u;
+
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h;
+}
+
+int
+cache_parse_time(char *s, uint64_t *sec, uint64_t *nsec)
+{
+	unsigned long long a, b;
+
+	if (sscanf(s, "%llu.%llu", &a, &b) != 2)
+		return -1;
+	*sec = a;
+	*nsec = b;
+	return 0;
+}
+
+void
+cache_load(char *fn, char *flagstring)
+{
+	FILE *fp;
+	struct cache_ent *ce;
+	struct cache_ent *list = NULL;
+	unsigned int n = 0;
+	unsigned int h;
+	char *l;
+	char *f[7];
+	int i;
+
+	fp = fopen(fn, "r");
+	if (!fp) {
+		if (errno == ENOENT)
+			return;
+		fprintf(stderr, "failed to open cache %s: %s\n", fn,
+			strerror(errno));
+		exit(-1);
+	}
+
+	l = getln(line, sizeof(line), fp);
+	if (!l || strncmp(l, "Cache: ", 7) != 0 ||
+	    !(f[0] = strchr(l + 7, ' '))) {
+		fprintf(stderr, "warning: ignoring malformed cache %s\n", fn);
+		goto out;
+	}
+	*f[0]++ = 0;
+	if (strcmp(l + 7, flagstring) ||
+	    strcmp(f[0], algo_name() ? algo_name() : algo->name)) {
+		if (verbose)
+			fprintf(stderr, "cache %s is for %s %s, ignored\n",
+				fn, l + 7, f[0]);
+		goto out;
+	}
+
+	while ((l = getln(line, sizeof(line), fp))) {
+		/* the path may contain spaces, so split from the end */
+		for (i = 6; i >= 0; --i) {
+			f[i] = strrchr(l, ' ');
+			if (!f[i] || f[i] == l)
+				goto malformed;
+			*f[i]++ = 0;
+		}
+		ce = alloc(sizeof(*ce));
+		memset(ce, 0, sizeof(*ce));
+		if (sscanf(f[0], "%" SCNu64, &ce->key.dev) != 1 ||
+		    sscanf(f[1], "%" SCNu64, &ce->key.ino) != 1 ||
+		    sscanf(f[2], "%" SCNu64, &ce->key.size) != 1 ||
+		    cache_parse_time(f[3], &ce->key.mtime_sec,
+				     &ce->key.mtime_nsec) ||
+		    cache_parse_time(f[4], &ce->key.ctime_sec,
+				     &ce->key.ctime_nsec) ||
+		    cache_parse_time(f[5], &ce->key.btime_sec,
+				     &ce->key.btime_nsec) ||
+		    parse_sum(f[6], ce->cs))
+			goto malformed;
+		ce->path = strdup(l);
+		ce->next = list;
+		list = ce;
+		++n;
+	}
+
+	for (cache_tab_size = 1; cache_tab_size < n; cache_tab_size <<= 1)
+		;
+	cache_tab = alloc(cache_tab_size * sizeof(*cache_tab));
+	memset(cache_tab, 0, cache_tab_size * sizeof(*cache_tab));
+	while (list) {
+		ce = list;
+		list = ce->next;
+		h = cache_hash(ce->path) & (cache_tab_size - 1);
+		ce->next = cache_tab[h];
+		cache_tab[h] = ce;
+	}
+out:
+	fclose(fp);
+	return;
+
+malformed:
+	fprintf(stderr, "malformed cache %s\n", fn);
+	exit(-1);
+}
+
+struct cache_ent *
+cache_lookup(char *path)
+{
+	struct cache_ent *ce;
+
+	if (!cache_tab)
+		return NULL;
+	ce = cache_tab[cache_hash(path) & (cache_tab_size - 1)];
+	for (; ce; ce = ce->next) {
+		if (strcmp(ce->path, path) == 0)
+			return ce;
+	}
+	return NULL;
+}
+
+void
+cache_key(int dirfd, char *name, struct stat64 *st, struct sum_key *key)
+{
+	struct statx stx;
+
+	memset(key, 0, sizeof(*key));
+	key->dev = st->st_dev;
+	key->ino = st->st_ino;
+	key->size = st->st_size;
+	key->mtime_sec = st->st_mtim.tv_sec;
+	key->mtime_nsec = st->st_mtim.tv_nsec;
+	key->ctime_sec = st->st_ctim.tv_sec;
+	key->ctime_nsec = st->st_ctim.tv_nsec;
+	if (xfstests_statx(dirfd, name, AT_SYMLINK_NOFOLLOW, STATX_BTIME,
+			   &stx) == 0 && (stx.stx_mask & STATX_BTIME)) {
+		key->btime_sec = stx.stx_btime.tv_sec;
+		key->btime_nsec = stx.stx_btime.tv_nsec;
+	}
+}
+
+/*
+ * Take the data sum of ent from the cache if its key matches.  Returns 1
+ * if it did, in which case the file does not need to be read.
+ */
+int
+cache_reuse(struct sum_ent *ent)
+{
+	struct cache_ent *ce;
+	char *fn;
+
+	fn = escape(ent->path);
+	ce = cache_lookup(fn);
+	free(fn);
+	if (!ce || cache_rehash ||
+	    (chunk_size && (gen_manifest || in_manifest)) ||
+	    memcmp(&ce->key, &ent->key, sizeof(ent->key)) != 0) {
+		__atomic_add_fetch(&cache_misses, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	__atomic_add_fetch(&cache_hits, 1, __ATOMIC_RELAXED);
+	sum_fini(&ent->cs);
+	memcpy(ent->cs.out, ce->cs, algo->size);
+	return 1;
+}
+
+void
+cache_write(struct sum_ent *ent)
+{
+	struct sum_key *k = &ent->key;
+	char *fn = escape(ent->path);
+	char *c = sum_to_string(&ent->cs);
+
+	fprintf(cache_fp, "%s %" PRIu64 " %" PRIu64 " %" PRIu64
+		" %" PRIu64 ".%09" PRIu64 " %" PRIu64 ".%09" PRIu64
+		" %" PRIu64 ".%09" PRIu64 " %s\n",
+		fn, k->dev, k->ino, k->size, k->mtime_sec, k->mtime_nsec,
+		k->ctime_sec, k->ctime_nsec, k->btime_sec, k->btime_nsec, c);
+	free(c);
+	free(fn);
+}
+
+struct sum_deque *deques;
+static __thread int worker_id;
+pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+int pool_queued;
+int pool_idle;
+int pool_stop;
+
+pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+void
+pool_push(int type, void *arg)
+{
+	struct sum_deque *dq = &deques[worker_id];
+	int tail;
+
+	pthread_mutex_lock(&dq->lock);
+	if (dq->count == dq->size) {
+		struct sum_task *t = alloc((dq->size + CHUNKS) * sizeof(*t));
+		int i;
+
+		for (i = 0; i < dq->count; ++i)
+			t[i] = dq->tasks[(dq->head + i) % dq->size];
+		free(dq->tasks);
+		dq->tasks = t;
+		dq->head = 0;
+		dq->size += CHUNKS;
+	}
+	tail = (dq->head + dq->count) % dq->size;
+	dq->tasks[tail].type = type;
+	dq->tasks[tail].arg = arg;
+	++dq->count;
+	pthread_mutex_unlock(&dq->lock);
+
+	pthread_mutex_lock(&pool_lock);
+	++pool_queued;
+	if (pool_idle)
+		pthread_cond_signal(&pool_cond);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+int
+pool_get(struct sum_task *task)
+{
+	struct sum_deque *dq;
+	int i;
+
+	for (i = 0; i < nthreads; ++i) {
+		dq = &deques[(worker_id + i) % nthreads];
+		pthread_mutex_lock(&dq->lock);
+		if (dq->count == 0) {
+			pthread_mutex_unlock(&dq->lock);
+			continue;
+		}
+		if (i == 0) {
+			/* our own deque: newest first */
+			*task = dq->tasks[(dq->head + dq->count - 1) % dq->size];
+		} else {
+			*task = dq->tasks[dq->head];
+			dq->head = (dq->head + 1) % dq->size;
+		}
+		--dq->count;
+		pthread_mutex_unlock(&dq->lock);
+
+		pthread_mutex_lock(&pool_lock);
+		--pool_queued;
+		pthread_mutex_unlock(&pool_lock);
+		return 1;
+	}
+
+	return 0;
+}
+
+void sum_dir_list(struct sum_dir *dir);
+void sum_file(struct sum_ent *ent);
+void sum_chunk(struct sum_chunk *chunk);
+
+void *
+pool_worker(void *arg)
+{
+	struct sum_task task;
+
+	worker_id = (long)arg;
+	while (1) {
+		if (pool_get(&task)) {
+			if (task.type == TASK_DIR)
+				sum_dir_list(task.arg);
+			else if (task.type == TASK_FILE)
+				sum_file(task.arg);
+			else
+				sum_chunk(task.arg);
+			continue;
+		}
+		pthread_mutex_lock(&pool_lock);
+		while (!pool_queued && !pool_stop) {
+			++pool_idle;
+			pthread_cond_wait(&pool_cond, &pool_lock);
+			--pool_idle;
+		}
+		if (pool_stop) {
+			pthread_mutex_unlock(&pool_lock);
+			break;
+		}
+		pthread_mutex_unlock(&pool_lock);
+	}
+
+	return NULL;
+}
+
+void
+wait_for(int *flag)
+{
+	pthread_mutex_lock(&done_lock);
+	while (!*flag)
+		pthread_cond_wait(&done_cond, &done_lock);
+	pthread_mutex_unlock(&done_lock);
+}
+
+void
+set_flag(int *flag)
+{
+	pthread_mutex_lock(&done_lock);
+	*flag = 1;
+	pthread_cond_signal(&done_cond);
+	pthread_mutex_unlock(&done_lock);
+}
+
+void sum_dir_put(struct sum_dir *dir);
+
+/*
+ * cs and meta of ent are complete.  This may in turn complete the
+ * containing directory and so on up the tree.  Once done is set, the
+ * main thread may free ent->sub, so nothing here touches it afterwards.
+ */
+void
+sum_ent_done(struct sum_ent *ent)
+{
+	struct sum_dir *dir = ent->dir;
+
+	if (ent->cs.ctx)
+		sum_fini(&ent->cs);
+	sum_fini(&ent->meta);
+	set_flag(&ent->done);
+	if (dir)
+		sum_dir_put(dir);
+}
+
+void
+sum_dir_put(struct sum_dir *dir)
+{
+	struct sum_ent *ent;
+	int i;
+
+	if (__atomic_sub_fetch(&dir->pending, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	for (i = 0; i < dir->nents; ++i) {
+		ent = &dir->ents[i];
+		if (ent->skip)
+			continue;
+		sum_add_sum(&dir->ent->cs, &ent->cs);
+		sum_add_sum(&dir->ent->cs, &ent->meta);
+	}
+	if (dir->d)
+		closedir(dir->d);
+	sum_ent_done(dir->ent);
+}
+
+void
+read_failed(struct sum_ent *ent)
+{
+	fprintf(stderr, "read failed for %s/%s: %s\n",
+		root_path, ent->path, strerror(errno));
+	exit(-1);
+}
+
+/*
+ * Sum one chunk.  Reads are positional, so chunks of one file can be
+ * read in parallel through the same fd.
+ */
+void
+sum_chunk(struct sum_chunk *chunk)
+{
+	struct sum_ent *ent = chunk->ent;
+	sum_t cs;
+	int ret;
+
+	sum_init(&cs);
+	ret = sum_range(ent->fd, chunk->off, chunk->off + chunk->len, &cs,
+			&chunk->has_data);
+	if (ret < 0) {
+		errno = -ret;
+		read_failed(ent);
+	}
+	sum_fini(&cs);
+	memcpy(chunk->cs, cs.out, algo->size);
+
+	if (__atomic_sub_fetch(&ent->chunks_pending, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	/* last chunk done, sum the chunk sums in order */
+	close(ent->fd);
+	if (flags[FLAG_STRUCTURE]) {
+		struct chunk_list *cl = &ent->chunks;
+		int i, n;
+
+		for (i = 0, n = 0; i < cl->n; ++i) {
+			if (cl->c[i].has_data)
+				cl->c[n++] = cl->c[i];
+		}
+		cl->n = n;
+	}
+	for (chunk = ent->chunks.c;
+	     chunk < ent->chunks.c + ent->chunks.n; ++chunk) {
+		sum_add_u64(&ent->cs, chunk->off);
+		sum_add(&ent->cs, chunk->cs, algo->size);
+	}
+	sum_ent_done(ent);
+}
+
+/*
+ * Split the open file into chunks and queue all but the first, which we
+ * sum ourselves.
+ */
+void
+sum_file_chunks(struct sum_ent *ent, int fd)
+{
+	struct stat64 st;
+	uint64_t off = 0;
+	int i;
+
+	if (fstat64(fd, &st))
+		read_failed(ent);
+	ent->fd = fd;
+	do {
+		chunk_add(&ent->chunks, off, st.st_size - off < chunk_size ?
+			  st.st_size - off : chunk_size);
+		off += chunk_size;
+	} while (off < st.st_size);
+
+	ent->chunks_pending = ent->chunks.n;
+	for (i = 0; i < ent->chunks.n; ++i)
+		ent->chunks.c[i].ent = ent;
+	for (i = ent->chunks.n - 1; i > 0; --i)
+		pool_push(TASK_CHUNK, &ent->chunks.c[i]);
+	sum_chunk(&ent->chunks.c[0]);
+}
+
 void
-sum(int dirfd, int level, sum_t *dircs, char *path_prefix, char *path_in)
+sum_file(struct sum_ent *ent)
 {
-	DIR *d;
+	int fd;
+	int ret;
+
+	if (verbose)
+		fprintf(stderr, "file %s\n", ent->name);
+	fd = openat(ent->dir->fd, ent->name, io_direct ? O_DIRECT : 0);
+	if (fd == -1 && errno == EINVAL && io_direct)
+		fd = openat(ent->dir->fd, ent->name, 0);
+	if (fd == -1 && flags[FLAG_OPEN_ERROR]) {
+		sum_add_u64(&ent->meta, errno);
+	} else if (fd == -1) {
+		fprintf(stderr, "open failed for %s/%s: %s\n",
+			root_path, ent->path, strerror(errno));
+		exit(-1);
+	}
+	if (fd != -1 && chunk_size) {
+		sum_file_chunks(ent, fd);
+		return;
+	}
+	if (fd != -1) {
+		ret = sum_range(fd, 0, UINT64_MAX, &ent->cs, NULL);
+		if (ret < 0) {
+			errno = -ret;
+			read_failed(ent);
+		}
+		close(fd);
+	}
+	sum_ent_done(ent);
+}
+
+void
+sum_dir_list(struct sum_dir *dir)
+{
+	struct sum_ent *dirent = dir->ent;
 	struct dirent *de;
 	char **namelist = NULL;
 	int alloclen = 0;
@@ -537,21 +1647,33 @@ sum(int dirfd, int level, sum_t *dircs, char *path_prefix, char *path_in)
 	int ret;
 	int fd;
 	int excl;
-	sum_file_data_t sum_file_data = flags[FLAG_STRUCTURE] ?
-			sum_file_data_strict : sum_file_data_permissive;
 	struct stat64 dir_st;
 
-	if (fstat64(dirfd, &dir_st)) {
+	if (dirent->dir) {
+		dir->fd = openat(dirent->dir->fd, dirent->name, 0);
+		if (dir->fd == -1 && flags[FLAG_OPEN_ERROR]) {
+			sum_add_u64(&dirent->meta, errno);
+			set_flag(&dir->listed);
+			sum_ent_done(dirent);
+			return;
+		} else if (dir->fd == -1) {
+			fprintf(stderr, "open failed for %s/%s: %s\n",
+				root_path, dirent->path, strerror(errno));
+			exit(-1);
+		}
+	}
+
+	if (fstat64(dir->fd, &dir_st)) {
 		perror("fstat");
 		exit(-1);
 	}
 
-	d = fdopendir(dirfd);
-	if (!d) {
+	dir->d = fdopendir(dir->fd);
+	if (!dir->d) {
 		perror("opendir");
 		exit(-1);
 	}
-	while((de = readdir(d))) {
+	while((de = readdir(dir->d))) {
 		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
 			continue;
 		if (entries == alloclen) {
@@ -571,156 +1693,242 @@ sum(int dirfd, int level, sum_t *dircs, char *path_prefix, char *path_in)
 		++entries;
 	}
 	qsort(namelist, entries, sizeof(*namelist), namecmp);
+
+	dir->ents = alloc(entries * sizeof(*dir->ents) + 1);
+	memset(dir->ents, 0, entries * sizeof(*dir->ents));
+	dir->nents = entries;
+	dir->pending = 1;
+
 	for (i = 0; i < entries; ++i) {
 		struct stat64 st;
-		sum_t cs;
-		sum_t meta;
-		char *path;
-
-		sum_init(&cs);
-		sum_init(&meta);
-		path = alloc(strlen(path_in) + strlen(namelist[i]) + 3);
-		sprintf(path, "%s/%s", path_in, namelist[i]);
+		struct sum_ent *ent = &dir->ents[i];
+		sum_t *meta = &ent->meta;
+		sum_t *cs = &ent->cs;
+
+		ent->dir = dir;
+		ent->name = namelist[i];
+		ent->path = alloc(strlen(dirent->path) + strlen(ent->name) + 3);
+		sprintf(ent->path, "%s/%s", dirent->path, ent->name);
 		for (excl = 0; excl < n_excludes; ++excl) {
-			if (strncmp(excludes[excl].path, path,
+			if (strncmp(excludes[excl].path, ent->path,
 			    excludes[excl].len) == 0)
-				goto next;
+				goto skip;
 		}
 
-		ret = fchdir(dirfd);
-		if (ret == -1) {
-			perror("fchdir");
-			exit(-1);
-		}
-		ret = lstat64(namelist[i], &st);
+		ret = fstatat64(dir->fd, ent->name, &st, AT_SYMLINK_NOFOLLOW);
 		if (ret) {
 			fprintf(stderr, "stat failed for %s/%s: %s\n",
-				path_prefix, path, strerror(errno));
+				root_path, ent->path, strerror(errno));
 			exit(-1);
 		}
 
 		/* We are crossing into a different subvol, skip this subtree. */
 		if (st.st_dev != dir_st.st_dev)
-			goto next;
+			goto skip;
+
+		ent->mode = st.st_mode;
+		sum_init(cs);
+		sum_init(meta);
+		__atomic_add_fetch(&dir->pending, 1, __ATOMIC_RELAXED);
 
-		sum_add_u64(&meta, level);
-		sum_add(&meta, namelist[i], strlen(namelist[i]));
+		sum_add_u64(meta, dir->level);
+		sum_add(meta, ent->name, strlen(ent->name));
 		if (!S_ISDIR(st.st_mode))
-			sum_add_u64(&meta, st.st_nlink);
+			sum_add_u64(meta, st.st_nlink);
 		if (flags[FLAG_UID])
-			sum_add_u64(&meta, st.st_uid);
+			sum_add_u64(meta, st.st_uid);
 		if (flags[FLAG_GID])
-			sum_add_u64(&meta, st.st_gid);
+			sum_add_u64(meta, st.st_gid);
 		if (flags[FLAG_MODE])
-			sum_add_u64(&meta, st.st_mode);
+			sum_add_u64(meta, st.st_mode);
 		if (flags[FLAG_ATIME])
-			sum_add_time(&meta, st.st_atime);
+			sum_add_time(meta, st.st_atime);
 		if (flags[FLAG_MTIME])
-			sum_add_time(&meta, st.st_mtime);
+			sum_add_time(meta, st.st_mtime);
 		if (flags[FLAG_CTIME])
-			sum_add_time(&meta, st.st_ctime);
+			sum_add_time(meta, st.st_ctime);
 		if (flags[FLAG_XATTRS] &&
 		    (S_ISDIR(st.st_mode) || S_ISREG(st.st_mode))) {
-			fd = openat(dirfd, namelist[i], 0);
+			fd = openat(dir->fd, ent->name, 0);
 			if (fd == -1 && flags[FLAG_OPEN_ERROR]) {
-				sum_add_u64(&meta, errno);
+				sum_add_u64(meta, errno);
 			} else if (fd == -1) {
 				fprintf(stderr, "open failed for %s/%s: %s\n",
-					path_prefix, path, strerror(errno));
+					root_path, ent->path, strerror(errno));
 				exit(-1);
 			} else {
-				ret = sum_xattrs(fd, &meta);
+				ret = sum_xattrs(fd, meta);
 				close(fd);
 				if (ret < 0) {
 					fprintf(stderr,
 						"failed to read xattrs from "
 						"%s/%s: %s\n",
-						path_prefix, path,
+						root_path, ent->path,
 						strerror(-ret));
 					exit(-1);
 				}
 			}
 		}
 		if (S_ISDIR(st.st_mode)) {
-			fd = openat(dirfd, namelist[i], 0);
-			if (fd == -1 && flags[FLAG_OPEN_ERROR]) {
-				sum_add_u64(&meta, errno);
-			} else if (fd == -1) {
-				fprintf(stderr, "open failed for %s/%s: %s\n",
-					path_prefix, path, strerror(errno));
-				exit(-1);
-			} else {
-				sum(fd, level + 1, &cs, path_prefix, path);
-				close(fd);
-			}
+			ent->sub = alloc(sizeof(*ent->sub));
+			memset(ent->sub, 0, sizeof(*ent->sub));
+			ent->sub->ent = ent;
+			ent->sub->fd = -1;
+			ent->sub->level = dir->level + 1;
+			pool_push(TASK_DIR, ent->sub);
+			continue;
 		} else if (S_ISREG(st.st_mode)) {
-			sum_add_u64(&meta, st.st_size);
-			if (flags[FLAG_DATA]) {
-				if (verbose)
-					fprintf(stderr, "file %s\n",
-						namelist[i]);
-				fd = openat(dirfd, namelist[i], 0);
-				if (fd == -1 && flags[FLAG_OPEN_ERROR]) {
-					sum_add_u64(&meta, errno);
-				} else if (fd == -1) {
-					fprintf(stderr,
-						"open failed for %s/%s: %s\n",
-						path_prefix, path,
-						strerror(errno));
-					exit(-1);
-				}
-				if (fd != -1) {
-					ret = sum_file_data(fd, &cs);
-					if (ret < 0) {
-						fprintf(stderr,
-							"read failed for "
-							"%s/%s: %s\n",
-							path_prefix, path,
-							strerror(errno));
-						exit(-1);
-					}
-					close(fd);
+			sum_add_u64(meta, st.st_size);
+			if (flags[FLAG_DATA] && cache_fp) {
+				cache_key(dir->fd, ent->name, &st, &ent->key);
+				ent->has_key = 1;
+				if (cache_reuse(ent)) {
+					sum_ent_done(ent);
+					continue;
 				}
 			}
+			if (flags[FLAG_DATA]) {
+				pool_push(TASK_FILE, ent);
+				continue;
+			}
 		} else if (S_ISLNK(st.st_mode)) {
-			ret = readlink(namelist[i], buf, sizeof(buf));
+			ret = readlinkat(dir->fd, ent->name, buf, sizeof(buf));
 			if (ret == -1) {
 				perror("readlink");
 				exit(-1);
 			}
-			sum_add(&cs, buf, ret);
+			sum_add(cs, buf, ret);
 		} else if (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode)) {
-			sum_add_u64(&cs, major(st.st_rdev));
-			sum_add_u64(&cs, minor(st.st_rdev));
+			sum_add_u64(cs, major(st.st_rdev));
+			sum_add_u64(cs, minor(st.st_rdev));
+		}
+		sum_ent_done(ent);
+		continue;
+skip:
+		ent->skip = 1;
+	}
+	free(namelist);
+
+	set_flag(&dir->listed);
+	sum_dir_put(dir);
+}
+
+void
+emit_chunks(struct chunk_list *cl)
+{
+	char *c;
+	int i;
+
+	for (i = 0; i < cl->n; ++i) {
+		c = alloc(algo->size * 2 + 1);
+		sum_to_hex(cl->c[i].cs, c);
+		fprintf(out_fp, "+%llu %llu %s\n",
+			(unsigned long long)cl->c[i].off,
+			(unsigned long long)cl->c[i].len, c);
+		free(c);
+	}
+}
+
+/*
+ * Walk the tree in sorted order as the workers finish it, writing or
+ * checking manifest lines and freeing everything that is no longer
+ * needed.  A directory's line comes after those of its contents.
+ */
+void
+emit_dir(struct sum_dir *dir)
+{
+	struct sum_ent *ent;
+	int i;
+
+	wait_for(&dir->listed);
+	for (i = 0; i < dir->nents; ++i) {
+		ent = &dir->ents[i];
+		if (ent->skip)
+			goto next;
+		if (ent->sub)
+			emit_dir(ent->sub);
+		wait_for(&ent->done);
+		if (ent->sub) {
+			free(ent->sub->ents);
+			free(ent->sub);
 		}
-		sum_fini(&cs);
-		sum_fini(&meta);
 		if (gen_manifest || in_manifest) {
 			char *fn;
 			char *m;
 			char *c;
 
-			if (S_ISDIR(st.st_mode))
-				strcat(path, "/");
-			fn = escape(path);
-			m = sum_to_string(&meta);
-			c = sum_to_string(&cs);
+			if (S_ISDIR(ent->mode))
+				strcat(ent->path, "/");
+			fn = escape(ent->path);
+			m = sum_to_string(&ent->meta);
+			c = sum_to_string(&ent->cs);
 
 			if (gen_manifest)
 				fprintf(out_fp, "%s %s %s\n", fn, m, c);
+			if (gen_manifest)
+				emit_chunks(&ent->chunks);
 			if (in_manifest)
-				check_manifest(fn, m, c, 0);
+				check_manifest(fn, m, c, &ent->chunks, 0);
 			free(c);
 			free(m);
 			free(fn);
 		}
-		sum_add_sum(dircs, &cs);
-		sum_add_sum(dircs, &meta);
+		if (ent->has_key)
+			cache_write(ent);
+		free(ent->chunks.c);
 next:
-		free(path);
+		free(ent->name);
+		free(ent->path);
 	}
 }
 
+void
+sum(int dirfd, sum_t *cs)
+{
+	struct sum_ent root;
+	struct sum_dir dir;
+	pthread_t *threads;
+	long i;
+
+	memset(&root, 0, sizeof(root));
+	memset(&dir, 0, sizeof(dir));
+	root.path = "";
+	root.sub = &dir;
+	sum_init(&root.cs);
+	sum_init(&root.meta);
+	dir.ent = &root;
+	dir.fd = dirfd;
+	dir.level = 1;
+
+	deques = alloc(nthreads * sizeof(*deques));
+	memset(deques, 0, nthreads * sizeof(*deques));
+	for (i = 0; i < nthreads; ++i)
+		pthread_mutex_init(&deques[i].lock, NULL);
+	pool_push(TASK_DIR, &dir);
+
+	threads = alloc(nthreads * sizeof(*threads));
+	for (i = 0; i < nthreads; ++i) {
+		if (pthread_create(&threads[i], NULL, pool_worker, (void *)i)) {
+			fprintf(stderr, "failed to create thread\n");
+			exit(-1);
+		}
+	}
+
+	emit_dir(&dir);
+	wait_for(&root.done);
+
+	pthread_mutex_lock(&pool_lock);
+	pool_stop = 1;
+	pthread_cond_broadcast(&pool_cond);
+	pthread_mutex_unlock(&pool_lock);
+	for (i = 0; i < nthreads; ++i)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	free(dir.ents);
+	memcpy(cs->out, root.cs.out, sizeof(cs->out));
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -731,11 +1939,12 @@ main(int argc, char *argv[])
 	int fd;
 	sum_t cs;
 	char flagstring[sizeof(flchar)];
+	char *cache_tmp = NULL;
 	int i;
 	int plen;
 	int elen;
 	int n_flags = 0;
-	const char *allopts = "heEfuUgGoOaAmMcCdDtTsSnNw:r:vx:";
+	const char *allopts = "heEfuUgGoOaAmMcCdDtTsSnNw:r:vx:j:H:K:Fb:q:L:P";
 
 	out_fp = stdout;
 	while ((c = getopt(argc, argv, allopts)) != EOF) {
@@ -806,6 +2015,52 @@ main(int argc, char *argv[])
 		case 'v':
 			++verbose;
 			break;
+		case 'H':
+			++n_flags;
+			set_algo(optarg);
+			break;
+		case 'K':
+			cache_file = optarg;
+			break;
+		case 'F':
+			cache_rehash = 1;
+			break;
+		case 'b':
+			++n_flags;
+			chunk_size = strtoull(optarg, NULL, 10);
+			if (!chunk_size) {
+				fprintf(stderr, "invalid chunk size %s\n",
+					optarg);
+				exit(-1);
+			}
+			break;
+		case 'q':
+			io_depth = atoi(optarg);
+			if (io_depth < 1) {
+				fprintf(stderr, "invalid queue depth %s\n",
+					optarg);
+				exit(-1);
+			}
+			break;
+		case 'L':
+			io_size = strtoul(optarg, NULL, 10);
+			if (!io_size || io_size % SUM_PIECE) {
+				fprintf(stderr, "invalid read size %s\n",
+					optarg);
+				exit(-1);
+			}
+			break;
+		case 'P':
+			io_direct = 1;
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			if (nthreads < 1) {
+				fprintf(stderr, "invalid thread count %s\n",
+					optarg);
+				exit(-1);
+			}
+			break;
 		case 'h':
 		case '?':
 			usage();
@@ -825,13 +2080,25 @@ main(int argc, char *argv[])
 			fprintf(stderr, "failed to read line from input\n");
 			exit(-1);
 		}
+		/* the hash is taken from the file, md5 if it names none */
+		algo = &sum_algos[0];
+		chunk_size = 0;
 		if (strncmp(l, "Flags: ", 7) == 0) {
 			l += 7;
 			in_manifest = 1;
+			if ((p = strstr(l, " Hash: "))) {
+				*p = 0;
+				set_algo(p + 7);
+			}
 			parse_flags(l);
 		} else if ((p = strchr(l, ':'))) {
 			*p++ = 0;
 			parse_flags(l);
+			if ((l = strchr(p, ':'))) {
+				*l++ = 0;
+				set_algo(p);
+				p = l;
+			}
 			checksum = strdup(p);
 		} else {
 			fprintf(stderr, "invalid input file format\n");
@@ -875,24 +2142,64 @@ main(int argc, char *argv[])
 		exit(-1);
 	}
 
-	if (gen_manifest)
-		fprintf(out_fp, "Flags: %s\n", flagstring);
+	if (gen_manifest) {
+		fprintf(out_fp, "Flags: %s", flagstring);
+		if (algo_name())
+			fprintf(out_fp, " Hash: %s", algo_name());
+		fprintf(out_fp, "\n");
+	}
 
-	sum_init(&cs);
-	sum(fd, 1, &cs, path, "");
-	sum_fini(&cs);
+	if (io_direct && chunk_size % 4096) {
+		fprintf(stderr, "chunk size must be a multiple of 4096 with -P\n");
+		exit(-1);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1)
+		nthreads = 1;
+
+	if (cache_file) {
+		cache_tmp = alloc(strlen(cache_file) + 5);
+		sprintf(cache_tmp, "%s.tmp", cache_file);
+		cache_load(cache_file, flagstring);
+		cache_fp = fopen(cache_tmp, "w");
+		if (!cache_fp) {
+			fprintf(stderr, "failed to open cache %s: %s\n",
+				cache_tmp, strerror(errno));
+			exit(-1);
+		}
+		fprintf(cache_fp, "Cache: %s %s\n", flagstring,
+			algo_name() ? algo_name() : algo->name);
+	}
+
+	root_path = path;
+	sum(fd, &cs);
+
+	if (cache_fp) {
+		if (fclose(cache_fp) || rename(cache_tmp, cache_file)) {
+			fprintf(stderr, "failed to write cache %s: %s\n",
+				cache_file, strerror(errno));
+			exit(-1);
+		}
+		if (verbose)
+			fprintf(stderr, "cache: %lu files reused, %lu read\n",
+				cache_hits, cache_misses);
+	}
 
-	close(fd);
 	if (in_manifest)
-		check_manifest("", "", "", 1);
+		check_manifest("", "", "", NULL, 1);
 
 	if (!checksum) {
 		if (in_manifest) {
 			fprintf(stderr, "malformed input\n");
 			exit(-1);
 		}
-		if (!gen_manifest)
+		if (!gen_manifest) {
 			fprintf(out_fp, "%s:", flagstring);
+			if (algo_name())
+				fprintf(out_fp, "%s:", algo_name());
+		}
 
 		fprintf(out_fp, "%s\n", sum_to_string(&cs));
 	} else {
@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log-writes.h"
+
+/*
+ * Write stream statistics for a log, printed as JSON so that runs against
+ * different kernels or mount options can be compared by scripts.
+ *
+ * Sizes are in bytes.  A write is sequential if it starts where the last
+ * write ended.  Overwrites are tracked per sector in a bitmap, the device is
+ * split into ranges of range_size bytes and the report has the bytes written
+ * and the distinct bytes written for each range that saw writes.
+ */
+
+#define LOG_STATS_BUCKETS	64
+
+struct log_stats_range {
+	u64 bytes;
+	u64 unique;
+};
+
+struct log_stats {
+	u64 sectorsize;
+	u64 range_size;
+	u64 entries;
+
+	u64 writes;
+	u64 write_bytes;
+	u64 seq_writes;
+	u64 seq_bytes;
+	u64 metadata_bytes;
+	u64 last_end;		/* sector after the last write */
+	u64 size_hist[LOG_STATS_BUCKETS];
+
+	u64 flushes;
+	u64 fuas;
+	u64 marks;
+	u64 intervals;		/* flush intervals with writes in them */
+	u64 interval_bytes;
+	u64 interval_entries;
+	u64 interval_min_bytes;
+	u64 interval_max_bytes;
+	u64 interval_max_entries;
+
+	u64 discards;
+	u64 discard_bytes;
+
+	unsigned long *written;	/* bit per sector written */
+	u64 written_len;	/* in longs */
+	struct log_stats_range *ranges;
+	u64 nr_ranges;
+	u64 unique_bytes;
+};
+
+#define BITS_PER_LONG	(8 * sizeof(unsigned long))
+
+struct log_stats *log_stats_alloc(struct log *log, u64 range_size)
+{
+	struct log_stats *st;
+
+	st = calloc(1, sizeof(*st));
+	if (!st) {
+		fprintf(stderr, "Couldn't allocate stats\n");
+		return NULL;
+	}
+	st->sectorsize = log->sectorsize;
+	st->range_size = range_size;
+	st->interval_min_bytes = -1ULL;
+	st->last_end = -1ULL;
+	return st;
+}
+
+void log_stats_free(struct log_stats *st)
+{
+	free(st->written);
+	free(st->ranges);
+	free(st);
+}
+
+static int log_stats_grow(struct log_stats *st, u64 end)
+{
+	u64 len = (end + BITS_PER_LONG - 1) / BITS_PER_LONG;
+	u64 nr = (end * st->sectorsize + st->range_size - 1) / st->range_size;
+	unsigned long *written;
+	struct log_stats_range *ranges;
+
+	if (len > st->written_len) {
+		len = len > 2 * st->written_len ? len : 2 * st->written_len;
+		written = realloc(st->written, len * sizeof(*written));
+		if (!written)
+			return -1;
+		memset(written + st->written_len, 0,
+		       (len - st->written_len) * sizeof(*written));
+		st->written = written;
+		st->written_len = len;
+	}
+	if (nr > st->nr_ranges) {
+		nr = nr > 2 * st->nr_ranges ? nr : 2 * st->nr_ranges;
+		ranges = realloc(st->ranges, nr * sizeof(*ranges));
+		if (!ranges)
+			return -1;
+		memset(ranges + st->nr_ranges, 0,
+		       (nr - st->nr_ranges) * sizeof(*ranges));
+		st->ranges = ranges;
+		st->nr_ranges = nr;
+	}
+	return 0;
+}
+
+static void log_stats_flush(struct log_stats *st)
+{
+	if (!st->interval_entries)
+		return;
+	st->intervals++;
+	if (st->interval_bytes < st->interval_min_bytes)
+		st->interval_min_bytes = st->interval_bytes;
+	if (st->interval_bytes > st->interval_max_bytes)
+		st->interval_max_bytes = st->interval_bytes;
+	if (st->interval_entries > st->interval_max_entries)
+		st->interval_max_entries = st->interval_entries;
+	st->interval_bytes = 0;
+	st->interval_entries = 0;
+}
+
+static int log_stats_write(struct log_stats *st, u64 sector, u64 nr_sectors)
+{
+	u64 bytes = nr_sectors * st->sectorsize;
+	u64 s, bit;
+	int bucket;
+
+	st->writes++;
+	st->write_bytes += bytes;
+	if (sector == st->last_end) {
+		st->seq_writes++;
+		st->seq_bytes += bytes;
+	}
+	st->last_end = sector + nr_sectors;
+	bucket = 63 - __builtin_clzll(bytes);
+	st->size_hist[bucket]++;
+
+	if (log_stats_grow(st, sector + nr_sectors)) {
+		fprintf(stderr, "Couldn't allocate stats\n");
+		return -1;
+	}
+	for (s = sector; s < sector + nr_sectors; s++) {
+		struct log_stats_range *r;
+
+		r = &st->ranges[s * st->sectorsize / st->range_size];
+		r->bytes += st->sectorsize;
+		bit = 1UL << (s % BITS_PER_LONG);
+		if (st->written[s / BITS_PER_LONG] & bit)
+			continue;
+		st->written[s / BITS_PER_LONG] |= bit;
+		r->unique += st->sectorsize;
+		st->unique_bytes += st->sectorsize;
+	}
+	return 0;
+}
+
+/*
+ * @st: the stats to add to.
+ * @entry: the entry header, from log_seek_next_entry().
+ *
+ * @return: 0, or -1 if there was an error.
+ */
+int log_stats_add(struct log_stats *st, struct log_write_entry *entry)
+{
+	u64 flags = le64_to_cpu(entry->flags);
+	u64 sector = le64_to_cpu(entry->sector);
+	u64 nr_sectors = le64_to_cpu(entry->nr_sectors);
+
+	st->entries++;
+	st->interval_entries++;
+	if (flags & LOG_MARK_FLAG)
+		st->marks++;
+	if (flags & LOG_DISCARD_FLAG) {
+		st->discards++;
+		st->discard_bytes += nr_sectors * st->sectorsize;
+	} else if (nr_sectors) {
+		if (log_stats_write(st, sector, nr_sectors))
+			return -1;
+		st->interval_bytes += nr_sectors * st->sectorsize;
+		if (flags & LOG_METADATA_FLAG)
+			st->metadata_bytes += nr_sectors * st->sectorsize;
+	}
+	if (flags & LOG_FUA_FLAG)
+		st->fuas++;
+	if (flags & LOG_FLUSH_FLAG) {
+		st->flushes++;
+		log_stats_flush(st);
+	}
+	return 0;
+}
+
+static double ratio(u64 a, u64 b)
+{
+	return b ? (double)a / b : 0;
+}
+
+void log_stats_print(struct log_stats *st)
+{
+	int i, first;
+	u64 r;
+
+	/* whatever follows the last flush counts as an interval too */
+	log_stats_flush(st);
+	if (!st->intervals)
+		st->interval_min_bytes = 0;
+
+	printf("{\n");
+	printf("  \"entries\": %llu,\n", (unsigned long long)st->entries);
+	printf("  \"sectorsize\": %llu,\n",
+		(unsigned long long)st->sectorsize);
+	printf("  \"marks\": %llu,\n", (unsigned long long)st->marks);
+
+	printf("  \"writes\": {\n");
+	printf("    \"count\": %llu,\n", (unsigned long long)st->writes);
+	printf("    \"bytes\": %llu,\n",
+		(unsigned long long)st->write_bytes);
+	printf("    \"sequential_count\": %llu,\n",
+		(unsigned long long)st->seq_writes);
+	printf("    \"sequential_bytes\": %llu,\n",
+		(unsigned long long)st->seq_bytes);
+	printf("    \"random_count\": %llu,\n",
+		(unsigned long long)(st->writes - st->seq_writes));
+	printf("    \"random_bytes\": %llu,\n",
+		(unsigned long long)(st->write_bytes - st->seq_bytes));
+	printf("    \"sequential_ratio\": %.4f,\n",
+		ratio(st->seq_bytes, st->write_bytes));
+	printf("    \"metadata_bytes\": %llu,\n",
+		(unsigned long long)st->metadata_bytes);
+	printf("    \"data_bytes\": %llu,\n",
+		(unsigned long long)(st->write_bytes - st->metadata_bytes));
+	printf("    \"size_histogram\": [");
+	for (i = 0, first = 1; i < LOG_STATS_BUCKETS; i++) {
+		if (!st->size_hist[i])
+			continue;
+		printf("%s\n      { \"min_bytes\": %llu, \"count\": %llu }",
+			first ? "" : ",", 1ULL << i,
+			(unsigned long long)st->size_hist[i]);
+		first = 0;
+	}
+	printf("%s]\n  },\n", first ? "" : "\n    ");
+
+	printf("  \"flushes\": {\n");
+	printf("    \"count\": %llu,\n", (unsigned long long)st->flushes);
+	printf("    \"fua_count\": %llu,\n", (unsigned long long)st->fuas);
+	printf("    \"intervals\": %llu,\n",
+		(unsigned long long)st->intervals);
+	printf("    \"interval_mean_bytes\": %.1f,\n",
+		ratio(st->write_bytes, st->intervals));
+	printf("    \"interval_min_bytes\": %llu,\n",
+		(unsigned long long)st->interval_min_bytes);
+	printf("    \"interval_max_bytes\": %llu,\n",
+		(unsigned long long)st->interval_max_bytes);
+	printf("    \"interval_mean_entries\": %.1f,\n",
+		ratio(st->entries, st->intervals));
+	printf("    \"interval_max_entries\": %llu\n",
+		(unsigned long long)st->interval_max_entries);
+	printf("  },\n");
+
+	printf("  \"discards\": {\n");
+	printf("    \"count\": %llu,\n", (unsigned long long)st->discards);
+	printf("    \"bytes\": %llu\n",
+		(unsigned long long)st->discard_bytes);
+	printf("  },\n");
+
+	printf("  \"overwrites\": {\n");
+	printf("    \"unique_bytes\": %llu,\n",
+		(unsigned long long)st->unique_bytes);
+	printf("    \"amplification\": %.4f,\n",
+		ratio(st->write_bytes, st->unique_bytes));
+	printf("    \"range_size\": %llu,\n",
+		(unsigned long long)st->range_size);
+	printf("    \"ranges\": [");
+	for (r = 0, first = 1; r < st->nr_ranges; r++) {
+		struct log_stats_range *rng = &st->ranges[r];
+
+		if (!rng->bytes)
+			continue;
+		printf("%s\n      { \"offset\": %llu, \"bytes\": %llu, "
+			"\"unique_bytes\": %llu, \"amplification\": %.4f }",
+			first ? "" : ",",
+			(unsigned long long)(r * st->range_size),
+			(unsigned long long)rng->bytes,
+			(unsigned long long)rng->unique,
+			ratio(rng->bytes, rng->unique));
+		first = 0;
+	}
+	printf("%s]\n  }\n}\n", first ? "" : "\n    ");
+}
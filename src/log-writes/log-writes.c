@@ -9,21 +9,34 @@
 #include <errno.h>
 #include <unistd.h>
 #include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <linux/falloc.h>
 #include "log-writes.h"
 
 int log_writes_verbose = 0;
 
+static int log_replay_wait(struct log *log);
+static void log_replay_stop(struct log *log);
+
 /*
  * @log: the log to free.
  *
- * This will close any open fd's the log has and free up its memory.
+ * This will finish any queued writes, close any open fd's the log has and
+ * free up its memory.
  */
 void log_free(struct log *log)
 {
+	log_replay_sync(log);
+	log_replay_stop(log);
 	if (log->replayfd >= 0)
 		close(log->replayfd);
 	if (log->logfd >= 0)
 		close(log->logfd);
+	free(log->index);
+	free(log->index_marks);
 	free(log);
 }
 
@@ -34,18 +47,37 @@ static int discard_range(struct log *log, u64 start, u64 len)
 	if (ioctl(log->replayfd, BLKDISCARD, &range) < 0) {
 		if (log_writes_verbose)
 			printf("replay device doesn't support discard, "
-			       "switching to writing zeros\n");
+			       "switching to zeroing\n");
 		log->flags |= LOG_DISCARD_NOT_SUPP;
 	}
 	return 0;
 }
 
+/*
+ * Zero the range in the cheapest way the replay device supports: punching
+ * a hole, which works for files and for devices that can unmap or write
+ * zeroes without sending them, then BLKZEROOUT, then writing zeroes.  The
+ * last two really write the range, so they skip ranges larger than
+ * log->max_zero_size.
+ */
 static int zero_range(struct log *log, u64 start, u64 len)
 {
-	u64 bufsize = len;
+	u64 range[2] = { start, len };
+	u64 bufsize = len < 1024 * 1024 ? len : 1024 * 1024;
 	ssize_t ret;
 	char *buf = NULL;
 
+	if (!(log->flags & LOG_PUNCH_NOT_SUPP)) {
+		if (!fallocate(log->replayfd,
+			       FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			       start, len))
+			return 0;
+		if (log_writes_verbose)
+			printf("replay device can't punch holes, switching "
+			       "to zeroout\n");
+		log->flags |= LOG_PUNCH_NOT_SUPP;
+	}
+
 	if (log->max_zero_size < len) {
 		if (log_writes_verbose)
 			printf("discard len %llu larger than max %llu\n",
@@ -54,6 +86,15 @@ static int zero_range(struct log *log, u64 start, u64 len)
 		return 0;
 	}
 
+	if (!(log->flags & LOG_ZEROOUT_NOT_SUPP)) {
+		if (!ioctl(log->replayfd, BLKZEROOUT, &range))
+			return 0;
+		if (log_writes_verbose)
+			printf("replay device doesn't support zeroout, "
+			       "switching to writing zeros\n");
+		log->flags |= LOG_ZEROOUT_NOT_SUPP;
+	}
+
 	while (!buf) {
 		buf = malloc(bufsize);
 		if (!buf)
@@ -84,21 +125,25 @@ static int zero_range(struct log *log, u64 start, u64 len)
 
 /*
  * @log: the log we are replaying.
- * @entry: the discard entry.
  *
- * Discard the given length.  If the device supports discard we will call that
- * ioctl, otherwise we will write 0's to emulate discard.  If the discard size
- * is larger than log->max_zero_size then we will simply skip the zero'ing if
- * the drive doesn't support discard.
+ * Discard the pending discard range.  If the device supports discard we will
+ * call that ioctl, otherwise we will zero the range to emulate discard, see
+ * zero_range().  Writes queued before the discard are written out first.
  */
-int log_discard(struct log *log, struct log_write_entry *entry)
+static int log_discard_flush(struct log *log)
 {
-	u64 start = le64_to_cpu(entry->sector) * log->sectorsize;
-	u64 size = le64_to_cpu(entry->nr_sectors) * log->sectorsize;
+	u64 start = log->discard_start;
+	u64 size = log->discard_len;
 	u64 max_chunk = 1 * 1024 * 1024 * 1024;
 
-	if (log->flags & LOG_IGNORE_DISCARD)
+	if (!size)
 		return 0;
+	log->discard_len = 0;
+	if (log_replay_wait(log))
+		return -1;
+	if (log_writes_verbose > 1)
+		printf("discarding %llu@%llu\n", (unsigned long long)size,
+		       (unsigned long long)start);
 
 	while (size) {
 		u64 len = size > max_chunk ? max_chunk : size;
@@ -121,6 +166,40 @@ int log_discard(struct log *log, struct log_write_entry *entry)
 	return 0;
 }
 
+/*
+ * @log: the log we are replaying.
+ * @entry: the discard entry.
+ *
+ * Discard the given length.  Discards that touch the pending discard range
+ * are merged into it, anything else issues the pending range first, so a run
+ * of discards costs one trip to the device.
+ */
+int log_discard(struct log *log, struct log_write_entry *entry)
+{
+	u64 start = le64_to_cpu(entry->sector) * log->sectorsize;
+	u64 size = le64_to_cpu(entry->nr_sectors) * log->sectorsize;
+	u64 end = log->discard_start + log->discard_len;
+
+	if (log->flags & LOG_IGNORE_DISCARD)
+		return 0;
+
+	if (log->discard_len && start <= end &&
+	    start + size >= log->discard_start) {
+		if (start + size > end)
+			end = start + size;
+		if (start < log->discard_start)
+			log->discard_start = start;
+		log->discard_len = end - log->discard_start;
+		return 0;
+	}
+
+	if (log_discard_flush(log))
+		return -1;
+	log->discard_start = start;
+	log->discard_len = size;
+	return 0;
+}
+
 #define DEFINE_LOG_FLAGS_STR_ENTRY(x)	\
 	{LOG_##x##_FLAG, #x}
 
@@ -215,6 +294,411 @@ int log_entry_valid(struct log_write_entry *entry)
 	return 1;
 }
 
+/*
+ * Replayed writes are queued up in batches and written out by a writer
+ * thread while we go on reading the log.  A batch is cut at every flush or
+ * fua, since ordering only matters across those, and before discards, which
+ * are done directly.  Within a batch, writes that are overwritten later in
+ * the batch are dropped and adjacent ones are merged into one pwritev.
+ */
+#define LOG_BATCH_SIZE		(8 * 1024 * 1024)
+#define LOG_BATCH_WRITES	1024
+#define LOG_NR_BATCHES		4
+#define LOG_READAHEAD		(32 * 1024 * 1024)
+
+/*
+ * A write in a batch, or a piece of one once overlaps are resolved.  start
+ * and end are byte offsets on the replay device, buf_off is where the data
+ * is in the batch buffer.
+ */
+struct log_batch_write {
+	u64 start;
+	u64 end;
+	size_t buf_off;
+};
+
+struct log_batch {
+	struct log_batch *next;
+	char *buf;
+	size_t size;
+	size_t len;
+	struct log_batch_write writes[LOG_BATCH_WRITES];
+	int nr_writes;
+	/* for resolving overlaps, every piece starts or ends at a write's */
+	struct log_batch_write pieces[2 * LOG_BATCH_WRITES];
+};
+
+struct log_replay {
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct log_batch *free;		/* the pool */
+	struct log_batch *queue;	/* waiting for the writer */
+	struct log_batch **queue_tail;
+	struct log_batch *cur;		/* being filled */
+	int nr_batches;
+	int busy;			/* the writer has a batch */
+	int stop;
+	int error;			/* a write failed */
+	off_t ra_pos;			/* log read-ahead is hinted up to here */
+};
+
+/*
+ * @b: the batch to resolve.
+ *
+ * @return: the number of pieces in b->pieces.
+ *
+ * Turn the writes of the batch into sorted, non-overlapping pieces holding
+ * the data that has to end up on the device.  Writes are added newest first
+ * and only fill in what isn't covered yet, so later writes win.
+ */
+static int log_batch_resolve(struct log_batch *b)
+{
+	struct log_batch_write *w, *p = b->pieces;
+	int nr = 0, lo, hi, mid, i;
+	u64 cur, next;
+
+	for (i = b->nr_writes - 1; i >= 0; i--) {
+		w = &b->writes[i];
+
+		/* first piece that ends past the start of this write */
+		lo = 0;
+		hi = nr;
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if (p[mid].end <= w->start)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		for (cur = w->start; cur < w->end; ) {
+			if (lo < nr && p[lo].start <= cur) {
+				cur = p[lo++].end;
+				continue;
+			}
+			next = lo < nr && p[lo].start < w->end ?
+				p[lo].start : w->end;
+			memmove(&p[lo + 1], &p[lo], (nr - lo) * sizeof(*p));
+			p[lo].start = cur;
+			p[lo].end = next;
+			p[lo].buf_off = w->buf_off + (cur - w->start);
+			lo++;
+			nr++;
+			cur = next;
+		}
+	}
+	return nr;
+}
+
+/*
+ * @log: the log we are replaying.
+ * @b: the batch to write out.
+ *
+ * @return: 0 if the batch was written, -1 if there was an error.
+ */
+static int log_batch_write(struct log *log, struct log_batch *b)
+{
+	struct iovec iov[LOG_BATCH_WRITES];
+	struct log_batch_write *p = b->pieces;
+	int nr = log_batch_resolve(b);
+	int i, j, cnt;
+	u64 len;
+	ssize_t ret;
+
+	for (i = 0; i < nr; i = j) {
+		len = 0;
+		for (j = i, cnt = 0; j < nr && cnt < LOG_BATCH_WRITES &&
+		     (j == i || p[j].start == p[j - 1].end); j++, cnt++) {
+			iov[cnt].iov_base = b->buf + p[j].buf_off;
+			iov[cnt].iov_len = p[j].end - p[j].start;
+			len += iov[cnt].iov_len;
+		}
+		if (log_writes_verbose > 2)
+			printf("writing %llu@%llu in %d pieces\n",
+			       (unsigned long long)len,
+			       (unsigned long long)p[i].start, cnt);
+		ret = pwritev(log->replayfd, iov, cnt, p[i].start);
+		if (ret != len) {
+			fprintf(stderr, "Error writing data: %d\n", errno);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void *log_writer(void *arg)
+{
+	struct log *log = arg;
+	struct log_replay *rp = log->replay;
+	struct log_batch *b;
+	int ret;
+
+	pthread_mutex_lock(&rp->lock);
+	for (;;) {
+		while (!rp->queue && !rp->stop)
+			pthread_cond_wait(&rp->cond, &rp->lock);
+		if (!rp->queue)
+			break;
+		b = rp->queue;
+		rp->queue = b->next;
+		if (!rp->queue)
+			rp->queue_tail = &rp->queue;
+		rp->busy = 1;
+		pthread_mutex_unlock(&rp->lock);
+
+		/* once a write failed, the rest are only drained */
+		ret = rp->error ? 0 : log_batch_write(log, b);
+
+		pthread_mutex_lock(&rp->lock);
+		if (ret)
+			rp->error = 1;
+		rp->busy = 0;
+		b->len = 0;
+		b->nr_writes = 0;
+		b->next = rp->free;
+		rp->free = b;
+		pthread_cond_broadcast(&rp->cond);
+	}
+	pthread_mutex_unlock(&rp->lock);
+	return NULL;
+}
+
+static int log_replay_start(struct log *log)
+{
+	struct log_replay *rp;
+
+	rp = calloc(1, sizeof(*rp));
+	if (!rp) {
+		fprintf(stderr, "Couldn't allocate replay state\n");
+		return -1;
+	}
+	pthread_mutex_init(&rp->lock, NULL);
+	pthread_cond_init(&rp->cond, NULL);
+	rp->queue_tail = &rp->queue;
+	log->replay = rp;
+
+	if (pthread_create(&rp->writer, NULL, log_writer, log)) {
+		fprintf(stderr, "Couldn't start writer thread\n");
+		log->replay = NULL;
+		free(rp);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * @log: the log we are replaying.
+ *
+ * Hand the batch being filled to the writer.
+ */
+static void log_batch_submit(struct log *log)
+{
+	struct log_replay *rp = log->replay;
+	struct log_batch *b = rp ? rp->cur : NULL;
+
+	if (!b)
+		return;
+	rp->cur = NULL;
+	if (!b->nr_writes) {
+		b->len = 0;
+		pthread_mutex_lock(&rp->lock);
+		b->next = rp->free;
+		rp->free = b;
+		pthread_mutex_unlock(&rp->lock);
+		return;
+	}
+
+	pthread_mutex_lock(&rp->lock);
+	b->next = NULL;
+	*rp->queue_tail = b;
+	rp->queue_tail = &b->next;
+	pthread_cond_broadcast(&rp->cond);
+	pthread_mutex_unlock(&rp->lock);
+}
+
+/*
+ * @log: the log we are replaying.
+ *
+ * @return: 0 if all queued writes are on the replay device, -1 if a write
+ * failed.
+ */
+static int log_replay_wait(struct log *log)
+{
+	struct log_replay *rp = log->replay;
+	int error;
+
+	if (!rp)
+		return 0;
+	log_batch_submit(log);
+
+	pthread_mutex_lock(&rp->lock);
+	while (rp->queue || rp->busy)
+		pthread_cond_wait(&rp->cond, &rp->lock);
+	error = rp->error;
+	pthread_mutex_unlock(&rp->lock);
+	return error ? -1 : 0;
+}
+
+/*
+ * @log: the log we are replaying.
+ *
+ * @return: 0 if everything replayed so far is on the replay device, -1 if
+ * there was an error.
+ *
+ * Write out all queued writes and the pending discard, and wait for them.
+ */
+int log_replay_sync(struct log *log)
+{
+	if (log_replay_wait(log))
+		return -1;
+	return log_discard_flush(log);
+}
+
+static void log_replay_stop(struct log *log)
+{
+	struct log_replay *rp = log->replay;
+	struct log_batch *b;
+
+	if (!rp)
+		return;
+
+	pthread_mutex_lock(&rp->lock);
+	rp->stop = 1;
+	pthread_cond_broadcast(&rp->cond);
+	pthread_mutex_unlock(&rp->lock);
+	pthread_join(rp->writer, NULL);
+
+	while ((b = rp->free)) {
+		rp->free = b->next;
+		free(b->buf);
+		free(b);
+	}
+	pthread_mutex_destroy(&rp->lock);
+	pthread_cond_destroy(&rp->cond);
+	free(rp);
+	log->replay = NULL;
+}
+
+/*
+ * @log: the log we are replaying.
+ * @size: how much data the next write has.
+ *
+ * @return: where to read the data of the next write to, NULL if there was
+ * an error.
+ *
+ * Make room in the batch being filled for a write of size bytes, handing it
+ * to the writer if it is full and taking another from the pool.
+ */
+static char *log_batch_buf(struct log *log, u64 size)
+{
+	struct log_replay *rp = log->replay;
+	struct log_batch *b;
+	char *buf;
+
+	if (!rp && log_replay_start(log))
+		return NULL;
+	rp = log->replay;
+
+	b = rp->cur;
+	if (b && (b->nr_writes == LOG_BATCH_WRITES ||
+		  b->len + size > b->size)) {
+		log_batch_submit(log);
+		b = NULL;
+	}
+
+	if (!b) {
+		pthread_mutex_lock(&rp->lock);
+		while (!rp->free && rp->nr_batches == LOG_NR_BATCHES &&
+		       !rp->error)
+			pthread_cond_wait(&rp->cond, &rp->lock);
+		if (rp->error) {
+			pthread_mutex_unlock(&rp->lock);
+			return NULL;
+		}
+		b = rp->free;
+		if (b)
+			rp->free = b->next;
+		else
+			rp->nr_batches++;
+		pthread_mutex_unlock(&rp->lock);
+
+		if (!b) {
+			b = calloc(1, sizeof(*b));
+			if (!b) {
+				fprintf(stderr, "Couldn't allocate batch\n");
+				return NULL;
+			}
+		}
+		rp->cur = b;
+	}
+
+	/* a single write bigger than a batch gets a batch of its own */
+	if (b->size < size || !b->buf) {
+		b->size = size > LOG_BATCH_SIZE ? size : LOG_BATCH_SIZE;
+		buf = realloc(b->buf, b->size);
+		if (!buf) {
+			fprintf(stderr, "Error allocating buffer %llu entry "
+				"%llu\n", (unsigned long long)size,
+				(unsigned long long)log->cur_entry - 1);
+			return NULL;
+		}
+		b->buf = buf;
+	}
+	return b->buf + b->len;
+}
+
+/*
+ * @log: the log we are replaying.
+ * @offset: where the write goes on the replay device.
+ * @size: how much data was read into the buffer from log_batch_buf().
+ */
+static void log_batch_add(struct log *log, u64 offset, u64 size)
+{
+	struct log_batch *b = log->replay->cur;
+	struct log_batch_write *w = &b->writes[b->nr_writes++];
+
+	w->start = offset;
+	w->end = offset + size;
+	w->buf_off = b->len;
+	b->len += size;
+}
+
+/*
+ * @log: the log we are replaying.
+ *
+ * Keep the kernel reading ahead of us in the log.
+ */
+static void log_readahead(struct log *log)
+{
+	struct log_replay *rp = log->replay;
+
+	if (log->cur_pos >= rp->ra_pos - LOG_READAHEAD &&
+	    log->cur_pos < rp->ra_pos - LOG_READAHEAD / 2)
+		return;
+	posix_fadvise(log->logfd, log->cur_pos, LOG_READAHEAD,
+		      POSIX_FADV_WILLNEED);
+	rp->ra_pos = log->cur_pos + LOG_READAHEAD;
+}
+
+/*
+ * @log: the log we are manipulating.
+ *
+ * Seeks done through the entry index only move log->cur_pos, catch the log
+ * file up with it before reading from it.
+ */
+static int log_sync_pos(struct log *log)
+{
+	if (!(log->flags & LOG_SEEK_PENDING))
+		return 0;
+	if (lseek(log->logfd, log->cur_pos, SEEK_SET) == (off_t)-1) {
+		fprintf(stderr, "Error seeking in log: %d\n", errno);
+		return -1;
+	}
+	log->flags &= ~LOG_SEEK_PENDING;
+	return 0;
+}
+
 /*
  * @log: the log we are replaying.
  * @entry: where we put the entry.
@@ -235,11 +719,13 @@ int log_replay_next_entry(struct log *log, struct log_write_entry *entry,
 	char *buf;
 	char flags_buf[LOG_FLAGS_BUF_SIZE];
 	ssize_t ret;
-	off_t offset;
+	u64 offset;
 	int skip = 0;
 
 	if (log->cur_entry >= log->nr_entries)
 		return 1;
+	if (log_sync_pos(log))
+		return -1;
 
 	ret = read(log->logfd, entry, read_size);
 	if (ret != read_size) {
@@ -276,8 +762,11 @@ int log_replay_next_entry(struct log *log, struct log_write_entry *entry,
 		       (unsigned long long)size,
 		       (unsigned long long)flags, flags_buf);
 	}
-	if (!size)
+	if (!size) {
+		if (flags & LOG_FLUSH_FLAG)
+			log_batch_submit(log);
 		return 0;
+	}
 
 	if (flags & LOG_DISCARD_FLAG)
 		return log_discard(log, entry);
@@ -291,28 +780,27 @@ int log_replay_next_entry(struct log *log, struct log_write_entry *entry,
 		return 0;
 	}
 
-	buf = malloc(size);
-	if (!buf) {
-		fprintf(stderr, "Error allocating buffer %llu entry %llu\n", (unsigned long long)size, (unsigned long long)log->cur_entry - 1);
+	/* writes after a discard mustn't be overtaken by it */
+	if (log_discard_flush(log))
+		return -1;
+	buf = log_batch_buf(log, size);
+	if (!buf)
 		return -1;
-	}
 
 	ret = read(log->logfd, buf, size);
 	if (ret != size) {
 		fprintf(stderr, "Error reading data: %d\n", errno);
-		free(buf);
 		return -1;
 	}
 	log->cur_pos += size;
+	log_readahead(log);
 
 	offset = le64_to_cpu(entry->sector) * log->sectorsize;
-	ret = pwrite(log->replayfd, buf, size, offset);
-	free(buf);
-	if (ret != size) {
-		fprintf(stderr, "Error writing data: %d\n", errno);
-		return -1;
-	}
+	log_batch_add(log, offset, size);
 
+	/* ordering only matters across flushes and fuas */
+	if (flags & (LOG_FLUSH_FLAG | LOG_FUA_FLAG))
+		log_batch_submit(log);
 	return 0;
 }
 
@@ -332,6 +820,13 @@ int log_seek_entry(struct log *log, u64 entry_num)
 		return -1;
 	}
 
+	if (log->index) {
+		log->cur_entry = entry_num;
+		log->cur_pos = log->index[entry_num].pos;
+		log->flags |= LOG_SEEK_PENDING;
+		return 0;
+	}
+
 	/* Skip the first sector containing the log super block */
 	log->cur_pos = lseek(log->logfd, log->sectorsize, SEEK_SET);
 	if (log->cur_pos == (off_t)-1) {
@@ -378,6 +873,50 @@ int log_seek_entry(struct log *log, u64 entry_num)
 	return 0;
 }
 
+/*
+ * @log: the log we are manipulating.
+ * @entry: the entry we fill in.
+ * @read_data: fill in the mark data for the entry, your entry must be
+ * log->sectorsize large.
+ *
+ * log_seek_next_entry() for a log with an entry index, the entry comes from
+ * the index and the log isn't touched.
+ */
+static int log_index_next_entry(struct log *log, struct log_write_entry *entry,
+				int read_data)
+{
+	struct log_index_entry *ie = &log->index[log->cur_entry];
+	char flags_buf[LOG_FLAGS_BUF_SIZE];
+	char *mark;
+
+	entry->sector = cpu_to_le64(ie->sector);
+	entry->nr_sectors = cpu_to_le64(ie->nr_sectors);
+	entry->flags = cpu_to_le64(ie->flags);
+	entry->data_len = cpu_to_le64(ie->data_len);
+	entry->data[0] = 0;
+	if (read_data && ie->mark) {
+		mark = log->index_marks + ie->mark - 1;
+		snprintf(entry->data, log->sectorsize -
+			 offsetof(struct log_write_entry, data), "%s", mark);
+	}
+	log->cur_entry++;
+	log->cur_pos = ie->pos + log->sectorsize;
+	log->flags |= LOG_SEEK_PENDING;
+
+	if (log_writes_verbose > 1) {
+		entry_flags_to_str(ie->flags, flags_buf);
+		printf("seek entry %d@%llu: %llu, size %llu, flags 0x%llx(%s)\n",
+		       (int)log->cur_entry - 1, log->cur_pos / log->sectorsize,
+		       (unsigned long long)ie->sector,
+		       (unsigned long long)ie->nr_sectors,
+		       (unsigned long long)ie->flags, flags_buf);
+	}
+
+	if (!(ie->flags & LOG_DISCARD_FLAG))
+		log->cur_pos += ie->nr_sectors * log->sectorsize;
+	return 0;
+}
+
 /*
  * @log: the log we are manipulating.
  * @entry: the entry we read.
@@ -400,6 +939,8 @@ int log_seek_next_entry(struct log *log, struct log_write_entry *entry,
 
 	if (log->cur_entry >= log->nr_entries)
 		return 1;
+	if (log->index)
+		return log_index_next_entry(log, entry, read_data);
 
 	ret = read(log->logfd, entry, read_size);
 	if (ret != read_size) {
@@ -445,6 +986,257 @@ int log_seek_next_entry(struct log *log, struct log_write_entry *entry,
 	return 0;
 }
 
+/*
+ * @log: the log we are indexing.
+ *
+ * @return: 0 if the index was built, -1 if the log couldn't be walked.
+ *
+ * Build the entry index by walking every entry header in the log.  This uses
+ * pread so the position in the log is left alone.
+ */
+static int log_index_build(struct log *log)
+{
+	struct log_index_entry *index;
+	struct log_write_entry *entry;
+	char *marks = NULL, *tmp;
+	u64 marks_len = 0;
+	size_t max_mark = log->sectorsize -
+		offsetof(struct log_write_entry, data) - 1;
+	size_t len;
+	off_t pos = log->sectorsize;
+	ssize_t ret;
+	u64 i;
+
+	index = calloc(log->nr_entries + 1, sizeof(*index));
+	entry = malloc(log->sectorsize);
+	if (!index || !entry) {
+		fprintf(stderr, "Couldn't allocate entry index\n");
+		goto out_err;
+	}
+
+	for (i = 0; i < log->nr_entries; i++) {
+		struct log_index_entry *ie = &index[i];
+
+		ret = pread(log->logfd, entry, sizeof(*entry), pos);
+		if (ret != sizeof(*entry)) {
+			if (log_writes_verbose)
+				printf("Error reading entry %llu: %d, not "
+				       "indexing log\n",
+				       (unsigned long long)i, errno);
+			goto out_err;
+		}
+		if (!log_entry_valid(entry)) {
+			if (log_writes_verbose)
+				printf("Malformed entry @%llu, not indexing "
+				       "log\n",
+				       (unsigned long long)pos / log->sectorsize);
+			goto out_err;
+		}
+
+		ie->pos = pos;
+		ie->sector = le64_to_cpu(entry->sector);
+		ie->nr_sectors = le64_to_cpu(entry->nr_sectors);
+		ie->flags = le64_to_cpu(entry->flags);
+		ie->data_len = le64_to_cpu(entry->data_len);
+
+		if (ie->flags & LOG_MARK_FLAG) {
+			ret = pread(log->logfd, entry, log->sectorsize, pos);
+			if (ret != log->sectorsize) {
+				if (log_writes_verbose)
+					printf("Error reading mark %llu: %d, "
+					       "not indexing log\n",
+					       (unsigned long long)i, errno);
+				goto out_err;
+			}
+			len = strnlen(entry->data, ie->data_len < max_mark ?
+						   ie->data_len : max_mark);
+			tmp = realloc(marks, marks_len + len + 1);
+			if (!tmp) {
+				fprintf(stderr, "Couldn't allocate entry "
+					"index\n");
+				goto out_err;
+			}
+			marks = tmp;
+			memcpy(marks + marks_len, entry->data, len);
+			marks[marks_len + len] = '\0';
+			ie->mark = marks_len + 1;
+			marks_len += len + 1;
+		}
+
+		pos += log->sectorsize;
+		if (!(ie->flags & LOG_DISCARD_FLAG))
+			pos += ie->nr_sectors * log->sectorsize;
+	}
+
+	free(entry);
+	log->index = index;
+	log->index_marks = marks;
+	log->index_marks_len = marks_len;
+	return 0;
+
+out_err:
+	free(entry);
+	free(index);
+	free(marks);
+	return -1;
+}
+
+/*
+ * @log: the log we are indexing.
+ * @ie: an entry from an index file.
+ *
+ * @return: 1 if the log has this entry where the index says it is, else 0.
+ */
+static int log_index_entry_matches(struct log *log,
+				   struct log_index_entry *ie)
+{
+	struct log_write_entry entry;
+
+	if (pread(log->logfd, &entry, sizeof(entry), ie->pos) !=
+	    sizeof(entry))
+		return 0;
+	return le64_to_cpu(entry.sector) == ie->sector &&
+	       le64_to_cpu(entry.nr_sectors) == ie->nr_sectors &&
+	       le64_to_cpu(entry.flags) == ie->flags &&
+	       le64_to_cpu(entry.data_len) == ie->data_len;
+}
+
+/*
+ * @log: the log we are indexing.
+ * @indexfile: the index file to read.
+ *
+ * @return: 0 if the index was loaded, -1 if it is missing or stale.
+ *
+ * Load the entry index from indexfile.  The index has to be for a log with
+ * as many entries and the same sector size, and the first and last entries
+ * it records have to still be in the log.
+ */
+static int log_index_read(struct log *log, char *indexfile)
+{
+	struct log_index_super super;
+	struct log_index_entry *index = NULL;
+	char *marks = NULL;
+	size_t size;
+	u64 i;
+	int fd;
+
+	fd = open(indexfile, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (read(fd, &super, sizeof(super)) != sizeof(super) ||
+	    super.magic != LOG_INDEX_MAGIC ||
+	    super.version != LOG_INDEX_VERSION ||
+	    super.nr_entries != log->nr_entries ||
+	    super.sectorsize != log->sectorsize)
+		goto out_stale;
+
+	size = log->nr_entries * sizeof(*index);
+	index = malloc(size + sizeof(*index));
+	marks = malloc(super.marks_len + 1);
+	if (!index || !marks)
+		goto out_stale;
+	if (read(fd, index, size) != size ||
+	    read(fd, marks, super.marks_len) != super.marks_len)
+		goto out_stale;
+	marks[super.marks_len] = '\0';
+
+	for (i = 0; i < log->nr_entries; i++) {
+		if (index[i].mark > super.marks_len)
+			goto out_stale;
+	}
+	if (log->nr_entries &&
+	    (!log_index_entry_matches(log, &index[0]) ||
+	     !log_index_entry_matches(log, &index[log->nr_entries - 1])))
+		goto out_stale;
+
+	close(fd);
+	log->index = index;
+	log->index_marks = marks;
+	log->index_marks_len = super.marks_len;
+	return 0;
+
+out_stale:
+	if (log_writes_verbose)
+		printf("Index %s doesn't match the log\n", indexfile);
+	close(fd);
+	free(index);
+	free(marks);
+	return -1;
+}
+
+/*
+ * @log: the log we are indexing.
+ * @indexfile: the index file to write.
+ *
+ * Save the entry index to indexfile.  It is written to a temporary file and
+ * renamed into place, so a reader never sees half an index.  Failing to save
+ * it only costs the next run a walk of the log.
+ */
+static void log_index_write(struct log *log, char *indexfile)
+{
+	struct log_index_super super = {
+		.magic = LOG_INDEX_MAGIC,
+		.version = LOG_INDEX_VERSION,
+		.nr_entries = log->nr_entries,
+		.sectorsize = log->sectorsize,
+		.marks_len = log->index_marks_len,
+	};
+	size_t size = log->nr_entries * sizeof(*log->index);
+	char *tmpfile;
+	int fd;
+
+	if (asprintf(&tmpfile, "%s.tmp", indexfile) < 0)
+		return;
+
+	fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto out_err;
+	if (write(fd, &super, sizeof(super)) != sizeof(super) ||
+	    write(fd, log->index, size) != size ||
+	    write(fd, log->index_marks, log->index_marks_len) !=
+			log->index_marks_len) {
+		close(fd);
+		goto out_err;
+	}
+	if (close(fd) || rename(tmpfile, indexfile))
+		goto out_err;
+	free(tmpfile);
+	return;
+
+out_err:
+	if (log_writes_verbose)
+		printf("Couldn't write index %s: %d\n", indexfile, errno);
+	unlink(tmpfile);
+	free(tmpfile);
+}
+
+/*
+ * @log: the log we are manipulating.
+ * @indexfile: where to keep the entry index, can be NULL.
+ *
+ * Give the log an entry index, so that seeking to an entry or searching for
+ * a mark, flush or fua doesn't have to read through the log.  The index is
+ * loaded from indexfile if that matches the log, otherwise it is built by
+ * walking the log once and saved to indexfile.  If the log can't be walked
+ * we go on without an index, seeks will report any problem when they get
+ * there.
+ */
+void log_load_index(struct log *log, char *indexfile)
+{
+	if (indexfile && !log_index_read(log, indexfile)) {
+		if (log_writes_verbose > 1)
+			printf("loaded index of %llu entries from %s\n",
+			       (unsigned long long)log->nr_entries,
+			       indexfile);
+		return;
+	}
+	if (log_index_build(log))
+		return;
+	if (indexfile)
+		log_index_write(log, indexfile);
+}
+
 /*
  * @logfile: the file that contains the write log.
  * @replayfile: the file/device to replay onto, can be NULL.
@@ -464,6 +1256,13 @@ struct log *log_open(char *logfile, char *replayfile)
 	}
 
 	log->replayfd = -1;
+	log->flags = 0;
+	log->index = NULL;
+	log->index_marks = NULL;
+	log->index_marks_len = 0;
+	log->replay = NULL;
+	log->discard_start = 0;
+	log->discard_len = 0;
 
 	log->logfd = open(logfile, O_RDONLY);
 	if (log->logfd < 0) {
@@ -514,6 +1313,7 @@ struct log *log_open(char *logfile, char *replayfile)
 		return NULL;
 	}
 	log->cur_entry = 0;
+	posix_fadvise(log->logfd, 0, 0, POSIX_FADV_SEQUENTIAL);
 
 	return log;
 }
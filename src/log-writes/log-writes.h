@@ -14,6 +14,7 @@ extern int log_writes_verbose;
 
 #define le64_to_cpu __le64_to_cpu
 #define le32_to_cpu __le32_to_cpu
+#define cpu_to_le64 __cpu_to_le64
 
 typedef __u64 u64;
 typedef __u32 u32;
@@ -61,8 +62,44 @@ struct log_write_entry {
 	char data[1];
 };
 
+/*
+ * The entry index, kept in memory and optionally saved to an index file so
+ * that later runs against the same log don't have to walk it again.
+ *
+ * pos - the log offset of the entry header.
+ * mark - offset of the mark name in the index mark table plus one, or 0 if
+ * this isn't a mark.
+ *
+ * The index file holds a log_index_super, nr_entries log_index_entry's and
+ * then marks_len bytes of nul terminated mark names, all in host byte order.
+ */
+struct log_index_entry {
+	u64 pos;
+	u64 sector;
+	u64 nr_sectors;
+	u64 flags;
+	u64 data_len;
+	u64 mark;
+};
+
+#define LOG_INDEX_VERSION 1
+#define LOG_INDEX_MAGIC 0x7864697377736c72
+
+struct log_index_super {
+	u64 magic;
+	u64 version;
+	u64 nr_entries;
+	u64 sectorsize;
+	u64 marks_len;
+};
+
 #define LOG_IGNORE_DISCARD (1 << 0)
 #define LOG_DISCARD_NOT_SUPP (1 << 1)
+#define LOG_SEEK_PENDING (1 << 2)
+#define LOG_PUNCH_NOT_SUPP (1 << 3)
+#define LOG_ZEROOUT_NOT_SUPP (1 << 4)
+
+struct log_replay;
 
 struct log {
 	int logfd;
@@ -75,14 +112,28 @@ struct log {
 	u64 cur_entry;
 	u64 max_zero_size;
 	off_t cur_pos;
+	struct log_index_entry *index;
+	char *index_marks;
+	u64 index_marks_len;
+	struct log_replay *replay;	/* queued writes, see log-writes.c */
+	u64 discard_start;		/* pending discard, in bytes */
+	u64 discard_len;
 };
 
 struct log *log_open(char *logfile, char *replayfile);
 int log_replay_next_entry(struct log *log, struct log_write_entry *entry,
 			  int read_data);
+int log_replay_sync(struct log *log);
 int log_seek_entry(struct log *log, u64 entry_num);
 int log_seek_next_entry(struct log *log, struct log_write_entry *entry,
 			int read_data);
+void log_load_index(struct log *log, char *indexfile);
 void log_free(struct log *log);
 
+struct log_stats;
+struct log_stats *log_stats_alloc(struct log *log, u64 range_size);
+int log_stats_add(struct log_stats *st, struct log_write_entry *entry);
+void log_stats_print(struct log_stats *st);
+void log_stats_free(struct log_stats *st);
+
 #endif
@@ -4,6 +4,12 @@
 #include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <linux/fs.h>
 #include "log-writes.h"
 
 enum option_indexes {
@@ -23,6 +29,11 @@ enum option_indexes {
 	START_MARK,
 	START_SECTOR,
 	END_SECTOR,
+	INDEX,
+	SNAPSHOT,
+	JOBS,
+	STATS,
+	STATS_RANGE,
 };
 
 static struct option long_options[] = {
@@ -42,6 +53,11 @@ static struct option long_options[] = {
 	{"start-mark", required_argument, NULL, 0},
 	{"start-sector", required_argument, NULL, 0},
 	{"end-sector", required_argument, NULL, 0},
+	{"index", required_argument, NULL, 0},
+	{"snapshot", required_argument, NULL, 0},
+	{"jobs", required_argument, NULL, 0},
+	{"stats", no_argument, NULL, 0},
+	{"stats-range", required_argument, NULL, 0},
 	{ NULL, 0, NULL, 0 },
 };
 
@@ -64,12 +80,24 @@ static void usage(void)
 	fprintf(stderr, "\t--no-discard - don't process discard entries\n");
 	fprintf(stderr, "\t--fsck - the fsck command to run, must specify "
 		"--check\n");
-	fprintf(stderr, "\t--check [<number>|flush|fua|discard] when to check "
-		"the file system, mush specify --fsck\n");
+	fprintf(stderr, "\t--check [<number>|flush|fua|discard|mark] when to "
+		"check the file system, mush specify --fsck\n");
+	fprintf(stderr, "\t--snapshot <dir> - run fsck on a snapshot of the "
+		"replay file in <dir>, named by $REPLAY_LOG_SNAPSHOT, while "
+		"the replay goes on; the replay target must be a regular "
+		"file\n");
+	fprintf(stderr, "\t--jobs <number> - number of fscks to run at once "
+		"with --snapshot\n");
 	fprintf(stderr, "\t--start-sector <sector> - replay ops on region "
 		"from <sector> onto <device>\n");
 	fprintf(stderr, "\t--end-sector <sector> - replay ops on region "
 		"to <sector> onto <device>\n");
+	fprintf(stderr, "\t--stats - print statistics of the writes in the "
+		"log as JSON, limited by the same options as --find\n");
+	fprintf(stderr, "\t--stats-range <bytes> - size of the device ranges "
+		"overwrites are reported for with --stats\n");
+	fprintf(stderr, "\t--index <file> - keep an index of the log entries "
+		"in <file>, to seek without reading the log\n");
 	fprintf(stderr, "\t-v or --verbose - print replayed ops\n");
 	fprintf(stderr, "\t-vv - print also skipped ops\n");
 	exit(1);
@@ -100,11 +128,204 @@ static int should_stop(struct log_write_entry *entry, u64 stop_flags,
 	return 0;
 }
 
+/*
+ * With --snapshot, each fsck runs in the background on its own copy of the
+ * replay file as it was at the entry being checked, so the replay doesn't
+ * wait for it.
+ */
+struct fsck_job {
+	pid_t pid;
+	u64 entry;
+	char *snapshot;
+};
+
+static char *snapshot_dir;
+static int snapshot_src = -1;	/* the replay file, opened for reading */
+static struct fsck_job *fsck_jobs;
+static int fsck_nr_jobs;
+static int fsck_max_jobs = 1;
+static u64 fsck_failed_entry;
+
+/*
+ * Copy the replay file to path.  Try to share its blocks with a reflink
+ * first, that only works if the snapshot directory is on the same file
+ * system and it can do it, otherwise copy the data, leaving zeroes as
+ * holes.  Block devices are refused up front, see main().
+ */
+static int snapshot_replay(char *path)
+{
+	struct stat st;
+	char *buf;
+	u64 size, off, len;
+	ssize_t ret;
+	size_t i;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Couldn't create snapshot %s: %d\n", path,
+			errno);
+		return -1;
+	}
+	if (ioctl(fd, FICLONE, snapshot_src) == 0) {
+		close(fd);
+		return 0;
+	}
+
+	if (fstat(snapshot_src, &st) < 0)
+		goto out_err;
+	size = st.st_size;
+	if (ftruncate(fd, size) < 0)
+		goto out_err;
+
+	buf = malloc(1024 * 1024);
+	if (!buf)
+		goto out_err;
+	for (off = 0; off < size; off += len) {
+		len = size - off < 1024 * 1024 ? size - off : 1024 * 1024;
+		ret = pread(snapshot_src, buf, len, off);
+		if (ret != len) {
+			free(buf);
+			goto out_err;
+		}
+		for (i = 0; i < len && !buf[i]; i++)
+			;
+		if (i < len && pwrite(fd, buf, len, off) != len) {
+			free(buf);
+			goto out_err;
+		}
+	}
+	free(buf);
+	close(fd);
+	return 0;
+
+out_err:
+	fprintf(stderr, "Couldn't copy replay file to snapshot %s: %d\n",
+		path, errno);
+	close(fd);
+	unlink(path);
+	return -1;
+}
+
+/*
+ * Wait for a background fsck to finish and remove its snapshot.  Returns -1
+ * if it failed, with fsck_failed_entry set to the entry it was checking.
+ */
+static int reap_fsck(void)
+{
+	struct fsck_job *job;
+	pid_t pid;
+	int status, i;
+
+	do {
+		pid = wait(&status);
+	} while (pid < 0 && errno == EINTR);
+	if (pid < 0)
+		return 0;
+
+	for (i = 0; i < fsck_nr_jobs; i++)
+		if (fsck_jobs[i].pid == pid)
+			break;
+	if (i == fsck_nr_jobs)
+		return 0;
+
+	job = &fsck_jobs[i];
+	unlink(job->snapshot);
+	free(job->snapshot);
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		fsck_failed_entry = job->entry;
+		status = -1;
+	} else {
+		status = 0;
+	}
+	fsck_jobs[i] = fsck_jobs[--fsck_nr_jobs];
+	return status;
+}
+
+/*
+ * Wait for all background fscks.  Returns -1 if any of them failed, with
+ * fsck_failed_entry set to the lowest entry that failed.
+ */
+static int wait_fsck(void)
+{
+	u64 failed = -1ULL;
+
+	while (fsck_nr_jobs) {
+		if (reap_fsck() && fsck_failed_entry < failed)
+			failed = fsck_failed_entry;
+	}
+	if (failed == -1ULL)
+		return 0;
+	fsck_failed_entry = failed;
+	return -1;
+}
+
+static int start_fsck(struct log *log, char *fsck_command)
+{
+	struct fsck_job *job;
+	char entry_str[32];
+	u64 entry = log->cur_entry - 1;
+	pid_t pid;
+
+	/* a failure found while waiting for a slot stops the replay */
+	while (fsck_nr_jobs == fsck_max_jobs) {
+		if (reap_fsck())
+			return -1;
+	}
+
+	job = &fsck_jobs[fsck_nr_jobs];
+	if (asprintf(&job->snapshot, "%s/replay-log.%d.%llu", snapshot_dir,
+		     (int)getpid(), (unsigned long long)entry) < 0) {
+		fprintf(stderr, "Couldn't allocate memory\n");
+		return -1;
+	}
+	if (snapshot_replay(job->snapshot)) {
+		free(job->snapshot);
+		return -1;
+	}
+
+	snprintf(entry_str, sizeof(entry_str), "%llu",
+		 (unsigned long long)entry);
+	setenv("REPLAY_LOG_SNAPSHOT", job->snapshot, 1);
+	setenv("REPLAY_LOG_ENTRY", entry_str, 1);
+	fflush(stdout);
+	fflush(stderr);
+
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "Couldn't start fsck: %d\n", errno);
+		unlink(job->snapshot);
+		free(job->snapshot);
+		return -1;
+	}
+	if (!pid) {
+		execl("/bin/sh", "sh", "-c", fsck_command, (char *)NULL);
+		_exit(127);
+	}
+
+	job->pid = pid;
+	job->entry = entry;
+	fsck_nr_jobs++;
+	return 0;
+}
+
 static int run_fsck(struct log *log, char *fsck_command)
 {
-	int ret = fsync(log->replayfd);
+	char entry_str[32];
+	int ret = log_replay_sync(log);
+
+	fsck_failed_entry = log->cur_entry - 1;
+	if (ret)
+		return ret;
+	ret = fsync(log->replayfd);
 	if (ret)
 		return ret;
+	if (snapshot_dir)
+		return start_fsck(log, fsck_command);
+
+	snprintf(entry_str, sizeof(entry_str), "%llu",
+		 (unsigned long long)log->cur_entry - 1);
+	setenv("REPLAY_LOG_ENTRY", entry_str, 1);
 	ret = system(fsck_command);
 	if (ret >= 0)
 		ret = WEXITSTATUS(ret);
@@ -116,6 +337,7 @@ enum log_replay_check_mode {
 	CHECK_FUA = 2,
 	CHECK_FLUSH = 3,
 	CHECK_DISCARD = 4,
+	CHECK_MARK = 5,
 };
 
 static int seek_to_mark(struct log *log, struct log_write_entry *entry,
@@ -138,6 +360,7 @@ static int seek_to_mark(struct log *log, struct log_write_entry *entry,
 int main(int argc, char **argv)
 {
 	char *logfile = NULL, *replayfile = NULL, *fsck_command = NULL;
+	char *indexfile = NULL;
 	struct log_write_entry *entry;
 	u64 stop_flags = 0;
 	u64 start_entry = 0;
@@ -150,6 +373,9 @@ int main(int argc, char **argv)
 	char *tmp = NULL;
 	struct log *log;
 	int find_mode = 0;
+	int stats_mode = 0;
+	u64 stats_range = 64 * 1024 * 1024;
+	struct log_stats *stats;
 	int c;
 	int opt_index;
 	int ret;
@@ -236,6 +462,17 @@ int main(int argc, char **argv)
 		case FIND:
 			find_mode = 1;
 			break;
+		case STATS:
+			stats_mode = 1;
+			break;
+		case STATS_RANGE:
+			stats_range = strtoull(optarg, &tmp, 0);
+			if (!stats_range || (tmp && *tmp != '\0')) {
+				fprintf(stderr, "Invalid range size\n");
+				exit(1);
+			}
+			tmp = NULL;
+			break;
 		case NUM_ENTRIES:
 			print_num_entries = 1;
 			break;
@@ -256,6 +493,8 @@ int main(int argc, char **argv)
 				check_mode = CHECK_FUA;
 			} else if (!strcmp(optarg, "discard")) {
 				check_mode = CHECK_DISCARD;
+			} else if (!strcmp(optarg, "mark")) {
+				check_mode = CHECK_MARK;
 			} else {
 				check_mode = CHECK_NUMBER;
 				check_number = strtoull(optarg, &tmp, 0);
@@ -283,6 +522,28 @@ int main(int argc, char **argv)
 			}
 			tmp = NULL;
 			break;
+		case SNAPSHOT:
+			snapshot_dir = strdup(optarg);
+			if (!snapshot_dir) {
+				fprintf(stderr, "Couldn't allocate memory\n");
+				exit(1);
+			}
+			break;
+		case JOBS:
+			fsck_max_jobs = strtol(optarg, &tmp, 0);
+			if (fsck_max_jobs < 1 || (tmp && *tmp != '\0')) {
+				fprintf(stderr, "Invalid number of jobs\n");
+				exit(1);
+			}
+			tmp = NULL;
+			break;
+		case INDEX:
+			indexfile = strdup(optarg);
+			if (!indexfile) {
+				fprintf(stderr, "Couldn't allocate memory\n");
+				exit(1);
+			}
+			break;
 		default:
 			usage();
 		}
@@ -294,6 +555,30 @@ int main(int argc, char **argv)
 	log = log_open(logfile, replayfile);
 	if (!log)
 		exit(1);
+	if (snapshot_dir && replayfile) {
+		struct stat st;
+
+		snapshot_src = open(replayfile, O_RDONLY);
+		fsck_jobs = calloc(fsck_max_jobs, sizeof(*fsck_jobs));
+		if (snapshot_src < 0 || !fsck_jobs ||
+		    fstat(snapshot_src, &st) < 0) {
+			fprintf(stderr, "Couldn't set up snapshots of %s: %d\n",
+				replayfile, errno);
+			log_free(log);
+			exit(1);
+		}
+		/*
+		 * A block device can't be reflinked, so every snapshot would
+		 * be a full copy of it.  Use a dm snapshot instead, or replay
+		 * onto an image file on a reflink capable file system.
+		 */
+		if (!S_ISREG(st.st_mode)) {
+			fprintf(stderr, "--snapshot needs a regular file to "
+				"replay onto, %s is not one\n", replayfile);
+			log_free(log);
+			exit(1);
+		}
+	}
 	free(logfile);
 	free(replayfile);
 
@@ -303,6 +588,11 @@ int main(int argc, char **argv)
 	log->start_sector = start_sector;
 	log->end_sector = end_sector;
 
+	if (indexfile) {
+		log_load_index(log, indexfile);
+		free(indexfile);
+	}
+
 	entry = malloc(log->sectorsize);
 	if (!entry) {
 		fprintf(stderr, "Couldn't allocate buffer\n");
@@ -321,9 +611,32 @@ int main(int argc, char **argv)
 			exit(1);
 	}
 
-	if ((fsck_command && !check_mode) || (!fsck_command && check_mode))
+	if ((fsck_command && !check_mode) || (!fsck_command && check_mode) ||
+	    (snapshot_dir && !fsck_command))
 		usage();
 
+	/* Report on the writes up to where --find would stop */
+	if (stats_mode) {
+		stats = log_stats_alloc(log, stats_range);
+		if (!stats) {
+			log_free(log);
+			exit(1);
+		}
+		while ((ret = log_seek_next_entry(log, entry, 1)) == 0) {
+			num_entries++;
+			ret = log_stats_add(stats, entry);
+			if (ret ||
+			    (run_limit && num_entries == run_limit) ||
+			    should_stop(entry, stop_flags, end_mark))
+				break;
+		}
+		if (ret >= 0)
+			log_stats_print(stats);
+		log_stats_free(stats);
+		log_free(log);
+		return ret < 0 ? 1 : 0;
+	}
+
 	/* We just want to find a given entry */
 	if (find_mode) {
 		while ((ret = log_seek_next_entry(log, entry, 1)) == 0) {
@@ -375,12 +688,15 @@ int main(int argc, char **argv)
 			else if ((check_mode == CHECK_DISCARD) &&
 				 should_stop(entry, LOG_DISCARD_FLAG, NULL))
 				ret = run_fsck(log, fsck_command);
+			else if ((check_mode == CHECK_MARK) &&
+				 (le64_to_cpu(entry->flags) & LOG_MARK_FLAG))
+				ret = run_fsck(log, fsck_command);
 			else
 				ret = 0;
 			if (ret) {
 				fprintf(stderr, "Fsck errored out on entry "
 					"%llu\n",
-					(unsigned long long)log->cur_entry - 1);
+					(unsigned long long)fsck_failed_entry);
 				break;
 			}
 		}
@@ -389,7 +705,14 @@ int main(int argc, char **argv)
 		    should_stop(entry, stop_flags, end_mark))
 			break;
 	}
+	if (log_replay_sync(log))
+		ret = -1;
 	fsync(log->replayfd);
+	if (wait_fsck()) {
+		fprintf(stderr, "Fsck errored out on entry %llu\n",
+			(unsigned long long)fsck_failed_entry);
+		ret = -1;
+	}
 	log_free(log);
 	free(end_mark);
 	if (ret < 0)
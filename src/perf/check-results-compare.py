@@ -0,0 +1,148 @@
+# SPDX-License-Identifier: GPL-2.0
+#
+# Compare the per-test results that check records in the RESULTS_DB database
+# between two sets of runs, and list the tests whose runtime (or one of the
+# resource counters) changed significantly.  Each set of runs is picked by
+# filters on the check_runs columns, for example
+#
+#   check-results-compare.py -d results.db -b kernel=6.12.0 -n kernel=6.13.0
+#
+# Only passing runs are used.  A test counts as changed when a two-sided
+# Mann-Whitney U test says the two sets of samples differ at the --alpha level
+# and the medians are at least --min-change percent and --min-delta apart.
+# Exits with status 1 if any test regressed.
+
+import argparse
+import math
+import sqlite3
+import sys
+
+metrics = [ 'runtime', 'user_ms', 'sys_ms', 'peak_kb', 'read_kb', 'write_kb',
+            'reads', 'writes', 'cpu_stall_ms', 'memory_stall_ms',
+            'io_stall_ms' ]
+run_columns = [ 'host', 'section', 'kernel', 'config' ]
+
+def _filter(arg):
+    key, sep, value = arg.partition('=')
+    if not sep or key not in run_columns:
+        raise argparse.ArgumentTypeError(
+            "expected one of {} as column=value".format(
+                ", ".join(run_columns)))
+    return (key, value)
+
+def load_samples(db, filters, metric):
+    where = "".join(" AND r.{} = ?".format(k) for k, v in filters)
+    cur = db.cursor()
+    cur.execute("SELECT c.test, c.{0} FROM check_results c "
+                "JOIN check_runs r ON c.run_id = r.id "
+                "WHERE c.status = 'pass' AND c.{0} IS NOT NULL{1}".format(
+                    metric, where),
+                tuple(v for k, v in filters))
+    samples = {}
+    for test, value in cur.fetchall():
+        samples.setdefault(test, []).append(float(value))
+    return samples
+
+def median(values):
+    values = sorted(values)
+    mid = len(values) // 2
+    if len(values) % 2:
+        return values[mid]
+    return (values[mid - 1] + values[mid]) / 2.0
+
+def mann_whitney(a, b):
+    '''Two-sided p-value of the Mann-Whitney U test for samples a and b
+
+    Uses the normal approximation with a correction for ties, which test
+    runtimes in whole seconds are full of, and a continuity correction.
+    '''
+    n1 = len(a)
+    n2 = len(b)
+    n = n1 + n2
+    values = sorted([(v, 0) for v in a] + [(v, 1) for v in b])
+
+    rank_sum = 0.0
+    ties = 0.0
+    i = 0
+    while i < n:
+        j = i
+        while j < n and values[j][0] == values[i][0]:
+            j += 1
+        rank = (i + 1 + j) / 2.0
+        rank_sum += rank * sum(1 for k in range(i, j) if values[k][1] == 0)
+        ties += (j - i) ** 3 - (j - i)
+        i = j
+
+    u = rank_sum - n1 * (n1 + 1) / 2.0
+    mean = n1 * n2 / 2.0
+    var = n1 * n2 / 12.0 * ((n + 1) - ties / (n * (n - 1)))
+    if var <= 0:
+        return 1.0
+    z = max(abs(u - mean) - 0.5, 0) / math.sqrt(var)
+    return math.erfc(z / math.sqrt(2))
+
+def compare(base, new, args):
+    regressed = []
+    improved = []
+    for test in sorted(set(base) & set(new)):
+        a = base[test]
+        b = new[test]
+        if len(a) < args.min_samples or len(b) < args.min_samples:
+            continue
+        old_median = median(a)
+        new_median = median(b)
+        delta = new_median - old_median
+        if abs(delta) < args.min_delta:
+            continue
+        if old_median and abs(delta) * 100 / old_median < args.min_change:
+            continue
+        p = mann_whitney(a, b)
+        if p >= args.alpha:
+            continue
+        change = "{:+.1f}%".format(delta * 100 / old_median) \
+                 if old_median else "new"
+        line = "  {}: {:g} -> {:g} ({}, p={:.3g}, n={}/{})".format(
+                test, old_median, new_median, change, p, len(a), len(b))
+        if delta > 0:
+            regressed.append(line)
+        else:
+            improved.append(line)
+    return regressed, improved
+
+parser = argparse.ArgumentParser()
+parser.add_argument('-d', '--db', type=str,
+                    help="The results db written by check", required=True)
+parser.add_argument('-b', '--base', type=_filter, action='append',
+                    default=[], help="column=value picking the baseline runs")
+parser.add_argument('-n', '--new', type=_filter, action='append',
+                    default=[], help="column=value picking the runs to check")
+parser.add_argument('-m', '--metric', choices=metrics, default='runtime',
+                    help="The per-test result to compare")
+parser.add_argument('--alpha', type=float, default=0.05,
+                    help="Significance level of the test")
+parser.add_argument('--min-change', type=float, default=10,
+                    help="Ignore changes of the median below this percentage")
+parser.add_argument('--min-delta', type=float, default=1,
+                    help="Ignore changes of the median below this amount")
+parser.add_argument('--min-samples', type=int, default=3,
+                    help="Passing runs a test needs in each set")
+args = parser.parse_args()
+
+if not args.base or not args.new:
+    parser.error("both --base and --new filters are required")
+
+db = sqlite3.connect(args.db)
+regressed, improved = compare(load_samples(db, args.base, args.metric),
+                              load_samples(db, args.new, args.metric), args)
+
+if regressed:
+    print("{} regressions:".format(args.metric))
+    print("\n".join(regressed))
+if improved:
+    print("{} improvements:".format(args.metric))
+    print("\n".join(improved))
+if not regressed and not improved:
+    print("No significant {} changes".format(args.metric))
+
+if regressed:
+    sys.exit(1)
@@ -0,0 +1,28 @@
+CREATE TABLE IF NOT EXISTS `check_runs` (
+  `id` INTEGER PRIMARY KEY AUTOINCREMENT,
+  `time` datetime NOT NULL,
+  `host` varchar(256) NOT NULL,
+  `section` varchar(256) NOT NULL,
+  `kernel` varchar(256) NOT NULL,
+  `config` varchar(32) NOT NULL,
+  `config_desc` text
+);
+CREATE TABLE IF NOT EXISTS `check_results` (
+  `id` INTEGER PRIMARY KEY AUTOINCREMENT,
+  `run_id` int NOT NULL,
+  `test` varchar(256) NOT NULL,
+  `status` varchar(16) NOT NULL,
+  `runtime` int,
+  `user_ms` int,
+  `sys_ms` int,
+  `peak_kb` int,
+  `read_kb` int,
+  `write_kb` int,
+  `reads` int,
+  `writes` int,
+  `cpu_stall_ms` int,
+  `memory_stall_ms` int,
+  `io_stall_ms` int
+);
+CREATE INDEX IF NOT EXISTS `check_results_run` ON `check_results` (`run_id`);
+CREATE INDEX IF NOT EXISTS `check_results_test` ON `check_results` (`test`);
@@ -0,0 +1,493 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Build the files, directories and attr forks that common/populate uses to
+ * create every metadata format, using a pool of worker threads.
+ *
+ * The shapes to build are read from stdin, one per line:
+ *
+ *	file PATH SIZE		write SIZE bytes of 0x62 and fsync
+ *	dir PATH END [opts]	create entries 0..END as popdir.pl does
+ *	attr PATH END [missing]	set user.%08d xattrs 0..END as popattr.py does
+ *	symlink PATH TARGET
+ *	mknod PATH c|b MAJ MIN, mknod PATH p
+ *	fragment PATH		punch every other block, as punch-alternating
+ *
+ * dir takes "missing", "start=N", "file-pct=N", "format=FMT" and "hardlink",
+ * which mean the same as the popdir.pl options.  "missing" removes every
+ * 19th entry starting at 1 once the others exist, like __populate_create_dir
+ * and __populate_create_attr.  Blank lines and lines starting with '#' are
+ * ignored.
+ *
+ * Each line is built start to finish by a single worker, so the formats
+ * come out the same as when the shell helpers build them one at a time;
+ * only the lines run concurrently.  Lines are handed out in order, so put
+ * the biggest ones first.
+ */
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/vfs.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "global.h"
+
+#define MAX_ARGS	8
+#define WRITE_BUFSZ	(1024 * 1024)
+
+struct job {
+	int		lineno;
+	int		argc;
+	char		*argv[MAX_ARGS];
+};
+
+struct op {
+	char		*name;
+	int		min_args;	/* not counting the op name */
+	int		max_args;
+	int		(*fn)(struct job *job);
+};
+
+static struct job	*jobs;
+static unsigned int	njobs;
+static unsigned int	next_job;
+static int		failed;
+static char		*write_buf;
+
+static int job_error(struct job *job, char *what)
+{
+	fprintf(stderr, "line %d: %s %s: %s: %s\n", job->lineno, job->argv[0],
+		job->argv[1], what, strerror(errno));
+	return -1;
+}
+
+static int parse_num(char *str, long long *val)
+{
+	char	*p;
+
+	errno = 0;
+	*val = strtoll(str, &p, 0);
+	return (errno || p == str || *p || *val < 0) ? -1 : 0;
+}
+
+/* Compute the file allocation unit size for an XFS file. */
+static int detect_xfs_alloc_unit(int fd)
+{
+	struct fsxattr fsx;
+	struct xfs_fsop_geom fsgeom;
+	int ret;
+
+	ret = ioctl(fd, XFS_IOC_FSGEOMETRY, &fsgeom);
+	if (ret)
+		return -1;
+
+	ret = ioctl(fd, XFS_IOC_FSGETXATTR, &fsx);
+	if (ret)
+		return -1;
+
+	ret = fsgeom.blocksize;
+	if (fsx.fsx_xflags & XFS_XFLAG_REALTIME)
+		ret *= fsgeom.rtextsize;
+
+	return ret;
+}
+
+static int do_file(struct job *job)
+{
+	long long	size;
+	off_t		offset;
+	ssize_t		ret;
+	size_t		len;
+	int		fd;
+
+	parse_num(job->argv[2], &size);
+
+	fd = open(job->argv[1], O_WRONLY | O_CREAT, 0666);
+	if (fd < 0)
+		return job_error(job, "open");
+
+	for (offset = 0; offset < size; offset += ret) {
+		len = size - offset;
+		if (len > WRITE_BUFSZ)
+			len = WRITE_BUFSZ;
+		ret = pwrite(fd, write_buf, len, offset);
+		if (ret <= 0) {
+			job_error(job, "pwrite");
+			close(fd);
+			return -1;
+		}
+	}
+
+	if (fsync(fd)) {
+		job_error(job, "fsync");
+		close(fd);
+		return -1;
+	}
+	return close(fd) ? job_error(job, "close") : 0;
+}
+
+static int do_dir(struct job *job)
+{
+	long long	end, start = 0, file_pct = 90, i;
+	char		*format = "%08d";
+	char		name[NAME_MAX + 1];
+	char		link_name[NAME_MAX + 1];
+	int		missing = 0, hardlink = 0;
+	int		dfd, fd, a;
+
+	parse_num(job->argv[2], &end);
+	for (a = 3; a < job->argc; a++) {
+		if (!strcmp(job->argv[a], "missing"))
+			missing = 1;
+		else if (!strcmp(job->argv[a], "hardlink"))
+			hardlink = 1;
+		else if (!strncmp(job->argv[a], "start=", 6))
+			parse_num(job->argv[a] + 6, &start);
+		else if (!strncmp(job->argv[a], "file-pct=", 9))
+			parse_num(job->argv[a] + 9, &file_pct);
+		else if (!strncmp(job->argv[a], "format=", 7))
+			format = job->argv[a] + 7;
+	}
+	if (hardlink) {
+		file_pct = 100;
+		snprintf(link_name, sizeof(link_name), format, (int)start);
+	}
+
+	if (mkdir(job->argv[1], 0777) && errno != EEXIST)
+		return job_error(job, "mkdir");
+	dfd = open(job->argv[1], O_RDONLY | O_DIRECTORY);
+	if (dfd < 0)
+		return job_error(job, "open");
+
+	for (i = start; i <= end; i++) {
+		snprintf(name, sizeof(name), format, (int)i);
+		if (hardlink && i > start) {
+			if (linkat(dfd, link_name, dfd, name, 0))
+				goto err;
+		} else if (i % 100 < file_pct) {
+			fd = openat(dfd, name, O_WRONLY | O_CREAT | O_TRUNC,
+				    0666);
+			if (fd < 0)
+				goto err;
+			close(fd);
+		} else if (mkdirat(dfd, name, 0755)) {
+			goto err;
+		}
+	}
+
+	for (i = 1; missing && i <= end; i += 19) {
+		snprintf(name, sizeof(name), format, (int)i);
+		if (unlinkat(dfd, name, 0) &&
+		    (errno != EISDIR || unlinkat(dfd, name, AT_REMOVEDIR)))
+			goto err;
+	}
+
+	close(dfd);
+	return 0;
+err:
+	job_error(job, name);
+	close(dfd);
+	return -1;
+}
+
+static int do_attr(struct job *job)
+{
+	long long	end, i;
+	char		name[32];
+	int		fd;
+
+	parse_num(job->argv[2], &end);
+
+	fd = open(job->argv[1], O_RDONLY | O_CREAT, 0666);
+	if (fd < 0)
+		return job_error(job, "open");
+
+	for (i = 0; i <= end; i++) {
+		snprintf(name, sizeof(name), "user.%08lld", i);
+		if (fsetxattr(fd, name, "abcdefgh", 8, 0))
+			goto err;
+	}
+
+	for (i = 1; job->argc > 3 && i <= end; i += 19) {
+		snprintf(name, sizeof(name), "user.%08lld", i);
+		if (fremovexattr(fd, name))
+			goto err;
+	}
+
+	close(fd);
+	return 0;
+err:
+	job_error(job, name);
+	close(fd);
+	return -1;
+}
+
+static int do_symlink(struct job *job)
+{
+	if (symlink(job->argv[2], job->argv[1]))
+		return job_error(job, "symlink");
+	return 0;
+}
+
+static int do_mknod(struct job *job)
+{
+	long long	major = 0, minor = 0;
+	mode_t		mode;
+
+	switch (job->argv[2][0]) {
+	case 'c':
+		mode = S_IFCHR;
+		break;
+	case 'b':
+		mode = S_IFBLK;
+		break;
+	default:
+		mode = S_IFIFO;
+		break;
+	}
+	if (mode != S_IFIFO) {
+		parse_num(job->argv[3], &major);
+		parse_num(job->argv[4], &minor);
+	}
+
+	if (mknod(job->argv[1], mode | 0666, makedev(major, minor)))
+		return job_error(job, "mknod");
+	return 0;
+}
+
+/*
+ * Punch out every other allocation unit, then fsync.  Files that do not
+ * exist are skipped, so callers can list files that only some feature
+ * combinations create.
+ */
+static int do_fragment(struct job *job)
+{
+	struct stat	s;
+	struct statfs	sf;
+	off_t		offset;
+	blksize_t	blksz;
+	int		mode = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+	int		fd, c;
+
+	fd = open(job->argv[1], O_WRONLY);
+	if (fd < 0)
+		return (errno == ENOENT || errno == EISDIR) ? 0 :
+			job_error(job, "open");
+
+	if (fstat(fd, &s) || fstatfs(fd, &sf))
+		goto err;
+	if (!S_ISREG(s.st_mode)) {
+		close(fd);
+		return 0;
+	}
+
+	c = detect_xfs_alloc_unit(fd);
+	if (c > 0)
+		blksz = c;
+	else
+		blksz = sf.f_bsize;
+
+	for (offset = 0; offset < s.st_size; offset += blksz * 2)
+		if (fallocate(fd, mode, offset, blksz))
+			goto err;
+
+	if (fsync(fd))
+		goto err;
+	return close(fd) ? job_error(job, "close") : 0;
+err:
+	job_error(job, "fragment");
+	close(fd);
+	return -1;
+}
+
+static struct op ops[] = {
+	{ "file",	2, 2, do_file },
+	{ "dir",	2, 7, do_dir },
+	{ "attr",	2, 3, do_attr },
+	{ "symlink",	2, 2, do_symlink },
+	{ "mknod",	2, 4, do_mknod },
+	{ "fragment",	1, 1, do_fragment },
+	{ NULL }
+};
+
+static struct op *find_op(char *name)
+{
+	struct op	*op;
+
+	for (op = ops; op->name; op++)
+		if (!strcmp(op->name, name))
+			return op;
+	return NULL;
+}
+
+/* Check a spec line well enough that the workers never see a bad one. */
+static int check_job(struct job *job)
+{
+	struct op	*op = find_op(job->argv[0]);
+	long long	val;
+	int		i;
+
+	if (!op) {
+		fprintf(stderr, "line %d: unknown op '%s'\n", job->lineno,
+			job->argv[0]);
+		return -1;
+	}
+	if (job->argc - 1 < op->min_args || job->argc - 1 > op->max_args)
+		goto bad;
+
+	if ((op->fn == do_file || op->fn == do_dir || op->fn == do_attr) &&
+	    parse_num(job->argv[2], &val))
+		goto bad;
+	if (op->fn == do_attr && job->argc > 3 &&
+	    strcmp(job->argv[3], "missing"))
+		goto bad;
+	if (op->fn == do_dir) {
+		for (i = 3; i < job->argc; i++) {
+			if (!strcmp(job->argv[i], "missing") ||
+			    !strcmp(job->argv[i], "hardlink") ||
+			    !strncmp(job->argv[i], "format=", 7))
+				continue;
+			if (!strncmp(job->argv[i], "start=", 6) &&
+			    !parse_num(job->argv[i] + 6, &val))
+				continue;
+			if (!strncmp(job->argv[i], "file-pct=", 9) &&
+			    !parse_num(job->argv[i] + 9, &val))
+				continue;
+			goto bad;
+		}
+	}
+	if (op->fn == do_mknod) {
+		if (!strcmp(job->argv[2], "p")) {
+			if (job->argc != 3)
+				goto bad;
+		} else if ((strcmp(job->argv[2], "c") &&
+			    strcmp(job->argv[2], "b")) ||
+			   job->argc != 5 || parse_num(job->argv[3], &val) ||
+			   parse_num(job->argv[4], &val)) {
+			goto bad;
+		}
+	}
+	return 0;
+bad:
+	fprintf(stderr, "line %d: bad arguments to '%s'\n", job->lineno,
+		job->argv[0]);
+	return -1;
+}
+
+static int read_spec(FILE *fp)
+{
+	struct job	*job;
+	char		*line = NULL, *tok, *save;
+	size_t		len = 0;
+	unsigned int	alloced = 0;
+	int		lineno = 0, ret = 0;
+
+	while (getline(&line, &len, fp) != -1) {
+		lineno++;
+		tok = strtok_r(line, " \t\n", &save);
+		if (!tok || *tok == '#')
+			continue;
+
+		if (njobs == alloced) {
+			alloced = alloced ? alloced * 2 : 64;
+			jobs = realloc(jobs, alloced * sizeof(*jobs));
+			if (!jobs) {
+				perror("realloc");
+				exit(2);
+			}
+		}
+		job = &jobs[njobs++];
+		job->lineno = lineno;
+		job->argc = 0;
+		for (; tok; tok = strtok_r(NULL, " \t\n", &save)) {
+			if (job->argc == MAX_ARGS) {
+				fprintf(stderr, "line %d: too many arguments\n",
+					lineno);
+				exit(1);
+			}
+			job->argv[job->argc] = strdup(tok);
+			if (!job->argv[job->argc++]) {
+				perror("strdup");
+				exit(2);
+			}
+		}
+		if (check_job(job))
+			ret = -1;
+	}
+	free(line);
+	return ret;
+}
+
+static void *worker(void *arg)
+{
+	unsigned int	i;
+
+	while ((i = __atomic_fetch_add(&next_job, 1, __ATOMIC_RELAXED)) <
+			njobs) {
+		if (find_op(jobs[i].argv[0])->fn(&jobs[i]))
+			__atomic_store_n(&failed, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+void usage(char *cmd)
+{
+	printf("Usage: %s [-j workers] < spec\n", cmd);
+	printf("Builds the files described by the spec on stdin with\n");
+	printf("'workers' threads, one per CPU by default.  See the\n");
+	printf("comment at the top of populate.c for the spec format.\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t	*threads;
+	long		nr_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	int		c, i, error;
+
+	while ((c = getopt(argc, argv, "j:")) != EOF) {
+		switch (c) {
+		case 'j':
+			nr_workers = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc || nr_workers <= 0)
+		usage(argv[0]);
+
+	if (read_spec(stdin))
+		return 1;
+	if (nr_workers > njobs)
+		nr_workers = njobs;
+
+	write_buf = malloc(WRITE_BUFSZ);
+	threads = calloc(nr_workers, sizeof(*threads));
+	if (!write_buf || !threads) {
+		perror("malloc");
+		return 2;
+	}
+	memset(write_buf, 0x62, WRITE_BUFSZ);
+
+	for (i = 0; i < nr_workers; i++) {
+		error = pthread_create(&threads[i], NULL, worker, NULL);
+		if (error) {
+			fprintf(stderr, "pthread_create: %s\n",
+				strerror(error));
+			/* the workers already running will do all the jobs */
+			if (i == 0)
+				return 2;
+			break;
+		}
+	}
+	while (--i >= 0)
+		pthread_join(threads[i], NULL);
+
+	return failed ? 2 : 0;
+}
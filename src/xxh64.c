@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Streaming implementation of XXH64, as described in the xxHash
+ * specification (doc/xxhash_spec.md in the xxHash sources).
+ */
+#include <string.h>
+#include <endian.h>
+#include "xxh64.h"
+
+#define PRIME64_1	0x9E3779B185EBCA87ULL
+#define PRIME64_2	0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3	0x165667B19E3779F9ULL
+#define PRIME64_4	0x85EBCA77C2B2AE63ULL
+#define PRIME64_5	0x27D4EB2F165667C5ULL
+
+static inline uint64_t
+rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+read64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le64toh(v);
+}
+
+static inline uint32_t
+read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le32toh(v);
+}
+
+static inline uint64_t
+xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static inline uint64_t
+xxh64_merge_round(uint64_t acc, uint64_t val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+static inline void
+xxh64_stripe(uint64_t *v, const uint8_t *p)
+{
+	v[0] = xxh64_round(v[0], read64(p));
+	v[1] = xxh64_round(v[1], read64(p + 8));
+	v[2] = xxh64_round(v[2], read64(p + 16));
+	v[3] = xxh64_round(v[3], read64(p + 24));
+}
+
+void
+xxh64_init(xxh64_state *st, uint64_t seed)
+{
+	memset(st, 0, sizeof(*st));
+	st->v[0] = seed + PRIME64_1 + PRIME64_2;
+	st->v[1] = seed + PRIME64_2;
+	st->v[2] = seed;
+	st->v[3] = seed - PRIME64_1;
+}
+
+void
+xxh64_update(xxh64_state *st, const void *input, size_t len)
+{
+	const uint8_t *p = input;
+	const uint8_t *end = p + len;
+	uint64_t v[4];
+
+	st->total_len += len;
+
+	if (st->memsize + len < 32) {
+		memcpy(st->mem + st->memsize, p, len);
+		st->memsize += len;
+		return;
+	}
+
+	if (st->memsize) {
+		memcpy(st->mem + st->memsize, p, 32 - st->memsize);
+		xxh64_stripe(st->v, st->mem);
+		p += 32 - st->memsize;
+		st->memsize = 0;
+	}
+
+	memcpy(v, st->v, sizeof(v));
+	while (p + 32 <= end) {
+		xxh64_stripe(v, p);
+		p += 32;
+	}
+	memcpy(st->v, v, sizeof(v));
+
+	if (p < end) {
+		memcpy(st->mem, p, end - p);
+		st->memsize = end - p;
+	}
+}
+
+uint64_t
+xxh64_digest(const xxh64_state *st)
+{
+	const uint8_t *p = st->mem;
+	const uint8_t *end = p + st->memsize;
+	uint64_t h;
+
+	if (st->total_len >= 32) {
+		h = rotl64(st->v[0], 1) + rotl64(st->v[1], 7) +
+		    rotl64(st->v[2], 12) + rotl64(st->v[3], 18);
+		h = xxh64_merge_round(h, st->v[0]);
+		h = xxh64_merge_round(h, st->v[1]);
+		h = xxh64_merge_round(h, st->v[2]);
+		h = xxh64_merge_round(h, st->v[3]);
+	} else {
+		/* v[2] still holds the seed */
+		h = st->v[2] + PRIME64_5;
+	}
+	h += st->total_len;
+
+	while (p + 8 <= end) {
+		h ^= xxh64_round(0, read64(p));
+		h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t)read32(p) * PRIME64_1;
+		h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	while (p < end) {
+		h ^= *p * PRIME64_5;
+		h = rotl64(h, 11) * PRIME64_1;
+		p++;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
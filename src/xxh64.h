@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Streaming implementation of the 64 bit xxHash (XXH64) non-cryptographic
+ * hash function.
+ */
+#ifndef _XXH64_H
+#define _XXH64_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define XXH64_OUT_LEN	8
+
+typedef struct {
+	uint64_t	total_len;
+	uint64_t	v[4];
+	uint8_t		mem[32];
+	uint32_t	memsize;
+} xxh64_state;
+
+extern void xxh64_init(xxh64_state *st, uint64_t seed);
+extern void xxh64_update(xxh64_state *st, const void *input, size_t len);
+extern uint64_t xxh64_digest(const xxh64_state *st);
+
+#endif